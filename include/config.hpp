@@ -8,10 +8,28 @@ namespace sjtu {
 
 typedef int64_t diskpos_t;
 
-constexpr size_t PAGE_SLOT_COUNT = 200;
-static_assert(PAGE_SLOT_COUNT % 2 == 0, "Slot count must be even!");
+// default byte size of a B+ tree page, each tree may choose its own
+constexpr size_t PAGE_BYTES = 8192;
 
-constexpr size_t CACHE_CAPACITY = 1600;
+// byte budget of one buffer manager's cache
+constexpr size_t CACHE_BYTES = 8 * 1024 * 1024;
+
+// share of a page filled when compaction rewrites a B+ tree
+constexpr double COMPACT_FILL = 0.9;
+
+// B+ tree leaves are refilled or merged only once below this share of their slots
+constexpr double MERGE_FILL = 0.25;
+
+// underfull leaves left by erase are rebalanced together once this many are waiting
+constexpr size_t BALANCE_BATCH = 64;
+
+// DynamicRiver slots are multiples of this many bytes, records of the same multiple share free slots
+constexpr size_t RIVER_GRANULE = 32;
+
+// Bloom filters in front of B+ tree lookups: about 1% false positives at full capacity
+constexpr size_t BLOOM_BITS_PER_KEY = 10;
+constexpr int BLOOM_HASHES = 7;
+constexpr size_t BLOOM_MIN_BITS = 1 << 16;
 
 typedef int64_t hash_t;
 
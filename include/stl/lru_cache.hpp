@@ -0,0 +1,86 @@
+#ifndef LRU_CACHE_HPP
+#define LRU_CACHE_HPP
+
+#include <cstddef>
+
+#include "list.hpp"
+#include "unordered_map.hpp"
+
+namespace sjtu {
+
+/*
+    Keeps the values of at most capacity keys, dropping the least recently
+    used one to make room. The keys are ordered from the most to the least
+    recently used in a list, and every entry remembers its place in it.
+*/
+template<typename KeyType, typename ValueType, typename Hasher = hash::MemoryHash<KeyType>>
+class lru_cache {
+private:
+    struct entry {
+        ValueType val_;
+        typename sjtu::list<KeyType>::iterator lru_it_;
+    };
+
+    sjtu::unordered_map<KeyType, entry, Hasher> entries_;
+    sjtu::list<KeyType> lru_list_;
+    std::size_t capacity_;
+
+public:
+    using size_type = std::size_t;
+
+    explicit lru_cache(size_type capacity) : capacity_(capacity) {}
+
+    lru_cache(const lru_cache&) = delete;
+    lru_cache& operator=(const lru_cache&) = delete;
+
+    // the cached value, or nullptr; a hit makes the key the most recently used
+    ValueType* get(const KeyType& key) {
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return nullptr;
+        }
+        lru_list_.erase(it->second->lru_it_);
+        lru_list_.push_front(key);
+        it->second->lru_it_ = lru_list_.begin();
+        return &it->second->val_;
+    }
+
+    void put(const KeyType& key, const ValueType& val) {
+        if (capacity_ == 0) {
+            return;
+        }
+        ValueType *cached = get(key);
+        if (cached) {
+            *cached = val;
+            return;
+        }
+        if (lru_list_.size() >= capacity_) {
+            entries_.erase(lru_list_.back());
+            lru_list_.pop_back();
+        }
+        lru_list_.push_front(key);
+        entries_.insert(key, entry{val, lru_list_.begin()});
+    }
+
+    void erase(const KeyType& key) {
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            return;
+        }
+        lru_list_.erase(it->second->lru_it_);
+        entries_.erase(key);
+    }
+
+    void clear() {
+        entries_.clear();
+        lru_list_.clear();
+    }
+
+    size_type size() const { return lru_list_.size(); }
+
+    size_type capacity() const { return capacity_; }
+};
+
+} // namespace sjtu
+
+#endif // LRU_CACHE_HPP
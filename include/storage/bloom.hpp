@@ -0,0 +1,166 @@
+#ifndef BLOOM_HPP
+#define BLOOM_HPP
+
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "../config.hpp"
+#include "../utils/comparator.hpp"
+
+namespace sjtu {
+#define BLOOM_FILTER_TYPE BloomFilter<KeyType>
+#define BLOOM_FILTER_TEMPLATE_ARGS template<typename KeyType>
+
+/*
+    Bloom filter over the keys of a B+ tree, kept in memory and saved to its
+    own file. Keys are hashed over their bytes with MemoryHash, and the two
+    hashes of a key pick its BLOOM_HASHES bits by double hashing.
+
+    Erased keys cannot be taken out, and added keys past the capacity raise
+    the false positive rate, so the owner rebuilds the filter from its keys
+    when full() says so. The header records whether the bits were saved
+    after the last change; a file left dirty by a crash is not trusted.
+
+        [clean flag] [word count] [keys added] [bit words...]
+*/
+template<typename KeyType>
+class BloomFilter {
+private:
+    std::string file_name_;
+    std::unique_ptr<uint64_t[]> bits_;
+    uint64_t words_ = 0;
+    uint64_t keys_ = 0;
+    // set once the bits differ from the saved ones
+    bool dirty_ = false;
+    constexpr static size_t header_bytes = 3 * sizeof(uint64_t);
+
+    void write_header(uint64_t clean);
+
+public:
+    BloomFilter() = default;
+
+    ~BloomFilter();
+
+    bool open(const std::string& file_name);
+
+    bool is_open() const;
+
+    void reset(size_t keys);
+
+    void add(const KeyType& key);
+
+    bool may_contain(const KeyType& key) const;
+
+    bool full() const;
+
+    void flush();
+
+};
+
+BLOOM_FILTER_TEMPLATE_ARGS
+BLOOM_FILTER_TYPE::~BloomFilter() {
+    flush();
+}
+
+BLOOM_FILTER_TEMPLATE_ARGS
+void BLOOM_FILTER_TYPE::write_header(uint64_t clean) {
+    std::fstream file(file_name_, std::ios::in | std::ios::out | std::ios::binary);
+    if (!file) {
+        file.open(file_name_, std::ios::out | std::ios::binary);
+    }
+    uint64_t header[3] = {clean, words_, keys_};
+    file.seekp(0);
+    file.write(reinterpret_cast<char *>(header), header_bytes);
+}
+
+// loads the saved bits; false if they are missing or stale and the filter has to be rebuilt
+BLOOM_FILTER_TEMPLATE_ARGS
+bool BLOOM_FILTER_TYPE::open(const std::string& file_name) {
+    file_name_ = file_name;
+    std::ifstream file(file_name_, std::ios::binary);
+    uint64_t header[3] = {0, 0, 0};
+    if (!file || !file.read(reinterpret_cast<char *>(header), header_bytes) || header[0] != 1 || header[1] == 0) {
+        return false;
+    }
+    words_ = header[1];
+    keys_ = header[2];
+    bits_ = std::make_unique<uint64_t[]>(words_);
+    if (!file.read(reinterpret_cast<char *>(bits_.get()), words_ * sizeof(uint64_t))) {
+        bits_.reset();
+        words_ = 0;
+        return false;
+    }
+    return true;
+}
+
+BLOOM_FILTER_TEMPLATE_ARGS
+bool BLOOM_FILTER_TYPE::is_open() const {
+    return bits_ != nullptr;
+}
+
+// empties the filter and sizes it for keys keys, BLOOM_BITS_PER_KEY bits each
+BLOOM_FILTER_TEMPLATE_ARGS
+void BLOOM_FILTER_TYPE::reset(size_t keys) {
+    uint64_t bits = BLOOM_MIN_BITS;
+    while (bits < keys * BLOOM_BITS_PER_KEY) {
+        bits <<= 1;
+    }
+    words_ = bits / 64;
+    keys_ = 0;
+    bits_ = std::make_unique<uint64_t[]>(words_);
+    memset(bits_.get(), 0, words_ * sizeof(uint64_t));
+    dirty_ = true;
+    write_header(0);
+}
+
+BLOOM_FILTER_TEMPLATE_ARGS
+void BLOOM_FILTER_TYPE::add(const KeyType& key) {
+    if (!dirty_) {
+        write_header(0);
+        dirty_ = true;
+    }
+    MemoryHash<KeyType> hash(key);
+    uint64_t bits = words_ * 64;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        uint64_t bit = static_cast<uint64_t>(hash.hash1() + i * hash.hash2()) % bits;
+        bits_[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+    keys_++;
+}
+
+// false means the key was never added; true may be a false positive
+BLOOM_FILTER_TEMPLATE_ARGS
+bool BLOOM_FILTER_TYPE::may_contain(const KeyType& key) const {
+    MemoryHash<KeyType> hash(key);
+    uint64_t bits = words_ * 64;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        uint64_t bit = static_cast<uint64_t>(hash.hash1() + i * hash.hash2()) % bits;
+        if (!(bits_[bit / 64] >> (bit % 64) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+BLOOM_FILTER_TEMPLATE_ARGS
+bool BLOOM_FILTER_TYPE::full() const {
+    return keys_ * BLOOM_BITS_PER_KEY > words_ * 64;
+}
+
+BLOOM_FILTER_TEMPLATE_ARGS
+void BLOOM_FILTER_TYPE::flush() {
+    if (!dirty_ || !bits_) {
+        return;
+    }
+    std::ofstream file(file_name_, std::ios::binary | std::ios::trunc);
+    uint64_t header[3] = {1, words_, keys_};
+    file.write(reinterpret_cast<char *>(header), header_bytes);
+    file.write(reinterpret_cast<char *>(bits_.get()), words_ * sizeof(uint64_t));
+    dirty_ = false;
+}
+
+} // namespace sjtu
+
+#endif // BLOOM_HPP
@@ -1,38 +1,177 @@
 #ifndef BPT_HPP
 #define BPT_HPP
 
+#include <algorithm>
+#include <cstdio>
+#include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 
 #include "../config.hpp"
 #include "page.hpp"
 #include "buffer.hpp"
+#include "bloom.hpp"
 #include "../stl/vector.hpp"
 
 namespace sjtu {
-#define BPT_TYPE BPlusTree<KeyType, ValueType>
-#define BPT_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
+/*
+    Shape of a tree as reported by BPlusTree::stats. level_pages_ counts
+    pages from the root down to the leaves. Fill is the used share of a
+    page's slots, or of its byte budget for compressed leaves if higher. free_pages_
+    counts pages left in the files but no longer reachable, and
+    sequentiality_ is the share of leaf links pointing to the physically
+    next page of the leaf file. valid_ is cleared, and error_ set, at the
+    first broken invariant.
+*/
+struct TreeStats {
+    int height_ = 0;
+    size_t entries_ = 0;
+    sjtu::vector<size_t> level_pages_;
+    double avg_leaf_fill_ = 0;
+    double min_leaf_fill_ = 0;
+    double avg_internal_fill_ = 0;
+    double min_internal_fill_ = 0;
+    size_t free_pages_ = 0;
+    double sequentiality_ = 0;
+    bool valid_ = true;
+    std::string error_;
+};
 
-BPT_TEMPLATE_ARGS
+/*
+    Read view of a tree taken by BPlusTree::snapshot. Reads through it see
+    the tree as it was when it was taken, whatever is written meanwhile.
+    Release it when done so the old page versions can go; clear and
+    compact end all snapshots.
+*/
+struct TreeSnapshot {
+    size_t leaf_epoch_ = 0;
+    size_t internal_epoch_ = 0;
+    diskpos_t root_ = 0;
+    int height_ = 0;
+};
+
+#define BPT_TYPE BPlusTree<KeyType, ValueType, page_bytes, compressed, unique>
+#define BPT_TEMPLATE_ARGS template<typename KeyType, typename ValueType, size_t page_bytes, bool compressed, bool unique>
+
+/*
+    page_bytes is the byte budget of both page kinds; slot counts follow from
+    the key and value sizes, so small keys get a wide fanout and large values
+    do not blow up the page. The cache of each file holds CACHE_BYTES.
+
+    With compressed set, leaves are written in the compressed format of
+    codec.hpp. A decoded leaf may then hold several times more entries, and
+    it is split when its encoded form no longer fits in page_bytes.
+
+    A tree opened with filtered keeps a Bloom filter of its keys in
+    <name>.bloom.dat, so lookups of absent keys mostly return without
+    reading a page.
+
+    With unique set, a key is stored at most once: inserting a key that is
+    already present fails whatever its value, and pairs are ordered by key
+    alone. Separators then hold only keys, so a large value type does not
+    narrow the internal pages. Trees whose keys repeat leave it unset and
+    keep the value in each separator to break ties.
+*/
+template<typename KeyType, typename ValueType, size_t page_bytes = PAGE_BYTES, bool compressed = false, bool unique = false>
 class BPlusTree {
 private:
-    BUFFER_MANAGER_TYPE buffer_;
-    std::shared_ptr<const PAGE_TYPE> cur_;
-    diskpos_t pos_;
+    constexpr static size_t leaf_entry_bytes = sizeof(KeyType) + sizeof(ValueType) + (has_key_prefix_v<KeyType> ? sizeof(uint64_t) : 0);
+    constexpr static size_t plain_leaf_slot_count = page_slot_count(page_bytes, leaf_entry_bytes);
+    constexpr static size_t compressed_slot_factor = 4;
+    constexpr static size_t leaf_slot_count = compressed ? plain_leaf_slot_count * compressed_slot_factor : plain_leaf_slot_count;
+    constexpr static size_t separator_bytes = unique ? sizeof(KeyType) : sizeof(KeyType) + sizeof(ValueType);
+    constexpr static size_t internal_slot_count = page_slot_count(page_bytes, separator_bytes + sizeof(diskpos_t));
+    static_assert(plain_leaf_slot_count >= 4, "Page too small for the key and value types!");
+    static_assert(internal_slot_count >= 4, "Page too small for the key type!");
+
+    typedef LeafPage<KeyType, ValueType, leaf_slot_count> leaf_page_t;
+    typedef InternalPage<KeyType, ValueType, internal_slot_count, !unique> internal_page_t;
+    typedef std::conditional_t<compressed,
+        CompressedLeafCodec<KeyType, ValueType, leaf_slot_count, page_bytes>, PlainCodec<leaf_page_t>> leaf_codec_t;
+    static_assert(compressed || sizeof(leaf_page_t) <= page_bytes, "Page exceeds its byte budget!");
+    static_assert(sizeof(internal_page_t) <= page_bytes, "Page exceeds its byte budget!");
+
+    // header slot 2 of the leaf file keeps the root, the same slot of the internal file keeps the height
+    constexpr static int root_info = 2;
+    constexpr static int height_info = 2;
+    // slot 3 of both files counts the compactions that wrote them, they differ only after an interrupted one
+    constexpr static int generation_info = 3;
+
+    BufferManager<leaf_page_t, leaf_codec_t> leaves_;
+    BufferManager<internal_page_t> internals_;
+    std::string file_name_;
     diskpos_t root_ = 0;
+    int height_ = 0;
+    // cached rightmost leaf, -1 if it has to be found again
+    diskpos_t last_leaf_ = -1;
+    bool filtered_;
+    BloomFilter<KeyType> bloom_;
+    double merge_fill_ = MERGE_FILL;
+    // a pair erased from each leaf left underfull, until the next rebalance
+    sjtu::vector<KEYPAIR_TYPE> underfull_;
+
+    /*
+        Pages keep no parent pointers. Every descent records the internal
+        pages it went through and the child taken in each, and structural
+        changes walk back up this path instead.
+    */
+    struct PathNode {
+        diskpos_t pos_;
+        int idx_;
+    };
+    sjtu::vector<PathNode> path_;
+
+    // pair order of the tree, by key alone when keys are unique
+    static bool before(const KEYPAIR_TYPE& a, const KEYPAIR_TYPE& b);
+
+    diskpos_t find_leaf(const KeyType& key);
+
+    diskpos_t find_leaf(const KEYPAIR_TYPE& kp);
+
+    diskpos_t descend_rightmost();
+
+    diskpos_t rightmost_leaf();
+
+    bool leaf_overflow(const leaf_page_t& page) const;
+
+    bool leaf_underflow(const leaf_page_t& page) const;
+
+    bool leaf_can_merge(const leaf_page_t& lp, const leaf_page_t& rp) const;
+
+    bool step_right(diskpos_t& pos);
 
-    void split();
+    bool step_left(diskpos_t& pos);
 
-    bool borrowl();
+    void remove_leaf(diskpos_t pos, const KEYPAIR_TYPE& first);
 
-    bool borrowr();
+    int split_point(size_t size, bool skew, int min_right);
 
-    void merge();
+    bool locate(const KEYPAIR_TYPE& kp, diskpos_t& pos, int& k);
 
-    void balance();
+    void insert_child(int depth, const KEYPAIR_TYPE& sep, diskpos_t right, bool skew);
+
+    void split_leaf(diskpos_t pos, bool skew);
+
+    void split_internal(int depth, bool skew);
+
+    void balance_leaf();
+
+    void balance_internal(int depth);
+
+    void fix_internal(int depth);
+
+    diskpos_t append_leaf(BufferManager<leaf_page_t, leaf_codec_t>& out, leaf_page_t& page, size_t count, diskpos_t prev);
+
+    void filter_add(const KeyType& key);
+
+    void rebuild_filter();
+
+    void check_page(diskpos_t pos, int level, const KEYPAIR_TYPE *lo, const KEYPAIR_TYPE *hi,
+        TreeStats& st, sjtu::vector<diskpos_t>& leaves);
 
 public:
-    BPlusTree(const std::string file_name = "bpt.dat");
+    BPlusTree(const std::string file_name = "bpt.dat", bool filtered = false);
 
     ~BPlusTree();
 
@@ -40,28 +179,71 @@ public:
 
     std::optional<ValueType> find(const KeyType& key);
 
+    std::optional<ValueType> find(const KeyType& key, const ValueType& val);
+
     void find_all(const KeyType& key, sjtu::vector<ValueType>& vec);
 
-    void insert(const KeyType& key, const ValueType& val);
+    bool insert(const KeyType& key, const ValueType& val);
 
     void erase(const KeyType& key, const ValueType& val);
 
+    size_t erase_range(const KeyType& lo, const KeyType& hi);
+
+    template<typename Mutator>
+    bool update(const KeyType& key, const ValueType& val, Mutator mutator);
+
+    bool upsert(const KeyType& key, const ValueType& val);
+
     void serialize(sjtu::vector<ValueType>& vec);
 
     void flush();
 
     void clear();
 
+    bool compact(double fill = COMPACT_FILL);
+
+    void set_merge_fill(double fill);
+
+    void rebalance();
+
+    TreeStats stats();
+
+    TreeSnapshot snapshot();
+
+    void release(const TreeSnapshot& snap);
+
+    template<typename Visitor>
+    void for_each(const TreeSnapshot& snap, Visitor visit);
+
 };
 
 BPT_TEMPLATE_ARGS
-BPT_TYPE::BPlusTree(const std::string file_name) : buffer_(CACHE_CAPACITY, file_name) {
-    root_ = buffer_.get_root_pos();
+BPT_TYPE::BPlusTree(const std::string file_name, bool filtered) :
+    leaves_(CACHE_BYTES / sizeof(leaf_page_t), file_name), internals_(CACHE_BYTES / page_bytes, file_name + ".internal.dat"),
+    file_name_(file_name), filtered_(filtered) {
+    std::string tmp_name = file_name_ + ".compact.dat";
+    diskpos_t generation = internals_.get_info(generation_info);
+    if (leaves_.get_info(generation_info) != generation) {
+        // a compaction stopped after switching the internal file, so its new leaf file is switched in too
+        if (!leaves_.replace(tmp_name) || leaves_.get_info(generation_info) != generation) {
+            throw std::runtime_error("cannot finish the compaction of " + file_name_);
+        }
+    }
+    // whatever an earlier compaction left behind before switching any file
+    std::remove(tmp_name.c_str());
+    std::remove((tmp_name + ".internal.dat").c_str());
+    root_ = leaves_.get_info(root_info);
+    height_ = static_cast<int>(internals_.get_info(height_info));
+    if (filtered_ && !bloom_.open(file_name + ".bloom.dat")) {
+        rebuild_filter();
+    }
 }
 
 BPT_TEMPLATE_ARGS
 BPT_TYPE::~BPlusTree() {
-    buffer_.set_root_pos(root_);
+    rebalance();
+    leaves_.set_info(root_info, root_);
+    internals_.set_info(height_info, height_);
 }
 
 BPT_TEMPLATE_ARGS
@@ -69,233 +251,349 @@ bool BPT_TYPE::empty() const {
     return root_ == 0;
 }
 
+BPT_TEMPLATE_ARGS
+diskpos_t BPT_TYPE::find_leaf(const KeyType& key) {
+    path_.clear();
+    diskpos_t pos = root_;
+    for (int level = height_; level > 1; level--) {
+        auto page = internals_.get_page(pos);
+        int idx = page->route(key);
+        path_.push_back(PathNode{pos, idx});
+        pos = page->ch_[idx];
+    }
+    return pos;
+}
+
+// descent to the leaf whose range holds kp, even inside a run of equal keys
+BPT_TEMPLATE_ARGS
+diskpos_t BPT_TYPE::find_leaf(const KEYPAIR_TYPE& kp) {
+    path_.clear();
+    diskpos_t pos = root_;
+    for (int level = height_; level > 1; level--) {
+        auto page = internals_.get_page(pos);
+        int idx = page->route(kp);
+        path_.push_back(PathNode{pos, idx});
+        pos = page->ch_[idx];
+    }
+    return pos;
+}
+
+BPT_TEMPLATE_ARGS
+diskpos_t BPT_TYPE::descend_rightmost() {
+    path_.clear();
+    diskpos_t pos = root_;
+    for (int level = height_; level > 1; level--) {
+        auto page = internals_.get_page(pos);
+        int idx = static_cast<int>(page->size_) - 1;
+        path_.push_back(PathNode{pos, idx});
+        pos = page->ch_[idx];
+    }
+    return pos;
+}
+
+BPT_TEMPLATE_ARGS
+diskpos_t BPT_TYPE::rightmost_leaf() {
+    if (last_leaf_ == -1) {
+        last_leaf_ = descend_rightmost();
+    }
+    return last_leaf_;
+}
+
+/*
+    Fill rules of leaves. Plain leaves count entries; compressed leaves are
+    limited by their encoded size, and only count as underfull when they
+    are small both in bytes and in entries. Leaves split when full but are
+    underfull only below merge_fill_, so a leaf refilled after a split or a
+    merge takes many erases before it is touched again.
+*/
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::leaf_overflow(const leaf_page_t& page) const {
+    if constexpr (compressed) {
+        return page.size_ >= leaf_slot_count || leaf_codec_t::encoded_size(page) > page_bytes;
+    }
+    else {
+        return page.size_ == leaf_slot_count;
+    }
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::leaf_underflow(const leaf_page_t& page) const {
+    if (page.size_ == 0) {
+        return true;
+    }
+    if constexpr (compressed) {
+        return page.size_ < leaf_slot_count * merge_fill_ && leaf_codec_t::encoded_size(page) < page_bytes * merge_fill_;
+    }
+    else {
+        return page.size_ < leaf_slot_count * merge_fill_;
+    }
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::leaf_can_merge(const leaf_page_t& lp, const leaf_page_t& rp) const {
+    if constexpr (compressed) {
+        return lp.size_ + rp.size_ < leaf_slot_count &&
+            leaf_codec_t::encoded_size(lp) + leaf_codec_t::encoded_size(rp) + leaf_codec_t::max_entry_bytes <= page_bytes;
+    }
+    else {
+        return true;
+    }
+}
+
+// moves the recorded path on to the next leaf, like a cursor
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::step_right(diskpos_t& pos) {
+    int depth = static_cast<int>(path_.size()) - 1;
+    while (depth >= 0 && path_[depth].idx_ + 1 >= static_cast<int>(internals_.get_page(path_[depth].pos_)->size_)) {
+        depth--;
+    }
+    if (depth < 0) {
+        return false;
+    }
+    path_[depth].idx_++;
+    pos = internals_.get_page(path_[depth].pos_)->ch_[path_[depth].idx_];
+    for (int i = depth + 1; i < static_cast<int>(path_.size()); i++) {
+        path_[i] = PathNode{pos, 0};
+        pos = internals_.get_page(pos)->ch_[0];
+    }
+    return true;
+}
+
+// moves the recorded path back to the previous leaf
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::step_left(diskpos_t& pos) {
+    int depth = static_cast<int>(path_.size()) - 1;
+    while (depth >= 0 && path_[depth].idx_ == 0) {
+        depth--;
+    }
+    if (depth < 0) {
+        return false;
+    }
+    path_[depth].idx_--;
+    pos = internals_.get_page(path_[depth].pos_)->ch_[path_[depth].idx_];
+    for (int i = depth + 1; i < static_cast<int>(path_.size()); i++) {
+        auto page = internals_.get_page(pos);
+        int idx = static_cast<int>(page->size_) - 1;
+        path_[i] = PathNode{pos, idx};
+        pos = page->ch_[idx];
+    }
+    return true;
+}
+
+/*
+    Monotonic keys (e.g. order timestamps) always land at the end of the
+    rightmost page. Splitting those pages in half would leave every page
+    half empty, so an append split keeps 90% on the left instead.
+*/
+BPT_TEMPLATE_ARGS
+int BPT_TYPE::split_point(size_t size, bool skew, int min_right) {
+    int half = static_cast<int>(size) / 2;
+    if (skew) {
+        half = static_cast<int>(size) * 9 / 10;
+        if (half > static_cast<int>(size) - min_right) {
+            half = static_cast<int>(size) - min_right;
+        }
+    }
+    return half;
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::before(const KEYPAIR_TYPE& a, const KEYPAIR_TYPE& b) {
+    if constexpr (unique) {
+        return compare_key(a.key_, b.key_) < 0;
+    }
+    else {
+        return a < b;
+    }
+}
+
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::locate(const KEYPAIR_TYPE& kp, diskpos_t& pos, int& k) {
+    pos = find_leaf(kp);
+    auto leaf = leaves_.get_page(pos);
+    k = leaf->lower_bound(kp);
+    return k < static_cast<int>(leaf->size_) && leaf->at(k) == kp;
+}
+
 BPT_TEMPLATE_ARGS
 std::optional<ValueType> BPT_TYPE::find(const KeyType& key) {
-    if (root_ == 0) {
+    if (root_ == 0 || (filtered_ && !bloom_.may_contain(key))) {
         return std::nullopt;
     }
-    pos_ = root_;
-    cur_ = buffer_.get_page(pos_);
-    while (cur_->type_ != PageType::Leaf) {
-        int k = cur_->lower_bound(key);
-        pos_ = cur_->ch_[k];
-        cur_ = buffer_.get_page(pos_);
+    diskpos_t pos = find_leaf(key);
+    auto leaf = leaves_.get_page(pos);
+    int k = leaf->lower_bound(key);
+    if (k == static_cast<int>(leaf->size_)) {
+        if (leaf->right_ == -1) {
+            return std::nullopt;
+        }
+        leaf = leaves_.get_page(leaf->right_);
+        k = 0;
     }
-    int k = cur_->lower_bound(key);
-    if (cur_->data_[k].key_ != key) {
+    if (leaf->keys_[k] != key) {
         return std::nullopt;
     }
-    return cur_->data_[k].val_;
+    return leaf->vals_[k];
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::find_all(const KeyType& key, sjtu::vector<ValueType>& vec) {
-    vec.clear();
-    if (root_ == 0) {
-        return;
+std::optional<ValueType> BPT_TYPE::find(const KeyType& key, const ValueType& val) {
+    if (root_ == 0 || (filtered_ && !bloom_.may_contain(key))) {
+        return std::nullopt;
     }
-    pos_ = root_;
-    cur_ = buffer_.get_page(pos_);
-    while (cur_->type_ != PageType::Leaf) {
-        int k = cur_->lower_bound(key);
-        pos_ = cur_->ch_[k];
-        cur_ = buffer_.get_page(pos_);
+    diskpos_t pos;
+    int k;
+    if (!locate(KEYPAIR_TYPE(key, val), pos, k)) {
+        return std::nullopt;
     }
-    int k = cur_->lower_bound(key);
-    if (cur_->data_[k].key_ != key) {
+    return leaves_.get_page(pos)->vals_[k];
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::find_all(const KeyType& key, sjtu::vector<ValueType>& vec) {
+    vec.clear();
+    if (root_ == 0 || (filtered_ && !bloom_.may_contain(key))) {
         return;
     }
-    int curk = k;
-    while (cur_->data_[curk].key_ == key) {
-        vec.push_back(cur_->data_[curk].val_);
-        if (curk < cur_->size_ - 1) {
-            curk++;
-        }
-        else {
-            if (cur_->right_ == -1) {
+    diskpos_t pos = find_leaf(key);
+    auto leaf = leaves_.get_page(pos);
+    int k = leaf->lower_bound(key);
+    while (true) {
+        if (k == static_cast<int>(leaf->size_)) {
+            if (leaf->right_ == -1) {
                 break;
             }
-            else {
-                pos_ = cur_->right_;
-                cur_ = buffer_.get_page(pos_);
-                curk = 0;
-            }
+            leaf = leaves_.get_page(leaf->right_);
+            k = 0;
         }
+        if (leaf->keys_[k] != key) {
+            break;
+        }
+        vec.push_back(leaf->vals_[k]);
+        k++;
     }
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::split() {
-    PAGE_TYPE newp;
-    newp.size_ = PAGE_SLOT_COUNT / 2;
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    diskpos_t parent_pos = cur_mut->fa_;
-    cur_mut->size_ = PAGE_SLOT_COUNT / 2;
-    if (cur_mut->type_ == PageType::Leaf) {
-        newp.type_ = PageType::Leaf;
-    }
-    else {
-        newp.type_ = PageType::Internal;
-    }
-    newp.fa_ = parent_pos;
-    newp.left_ = cur_pos;
-    newp.right_ = cur_mut->right_;
-    if (cur_mut->type_ == PageType::Leaf) {
-        for (int i = 0; i < newp.size_; i++) {
-            newp.data_[i] = cur_mut->data_[i + newp.size_];
-        }
-        KEYPAIR_TYPE split_at = cur_mut->back();
-        KEYPAIR_TYPE max_pair = newp.back();
-        if (parent_pos != -1) {
-            auto f = buffer_.get_page_mutable(parent_pos);
-            diskpos_t fa_pos = f->lower_bound(max_pair);
-            for (int i = f->size_ - 1; i >= fa_pos; i--) {
-                f->data_[i + 1] = f->data_[i];
-                f->ch_[i + 1] = f->ch_[i];
-            }
-            diskpos_t newp_pos = buffer_.insert_page(newp);
-            f->data_[fa_pos] = split_at;
-            f->data_[fa_pos + 1] = max_pair;
-            f->ch_[fa_pos] = cur_pos;
-            f->ch_[fa_pos + 1] = newp_pos;
-            f->size_++;
-            if (cur_mut->right_ != -1) {
-                auto rp = buffer_.get_page_mutable(cur_mut->right_);
-                rp->left_ = newp_pos;
-                buffer_.finish_use(cur_mut->right_);
-            }
-            cur_mut->right_ = newp_pos;
-            bool need_split_parent = (f->size_ == PAGE_SLOT_COUNT);
-            buffer_.finish_use(parent_pos);
-            buffer_.finish_use(cur_pos);
-            if (need_split_parent) {
-                pos_ = parent_pos;
-                split();
-            }
-        }
-        else {
-            PAGE_TYPE newr;
-            newr.type_ = PageType::Internal;
-            newr.size_ = 2;
-            newr.data_[0] = split_at;
-            newr.data_[1] = max_pair;
-            newr.ch_[0] = cur_pos;
-            diskpos_t newp_pos = buffer_.insert_page(newp);
-            newr.ch_[1] = newp_pos;
-            cur_mut->right_ = newp_pos;
-            root_ = buffer_.insert_page(newr);
-            cur_mut->fa_ = root_;
-            auto newp_mut = buffer_.get_page_mutable(newp_pos);
-            newp_mut->fa_ = root_;
-            buffer_.finish_use(newp_pos);
-            buffer_.finish_use(cur_pos);
-        }
+void BPT_TYPE::insert_child(int depth, const KEYPAIR_TYPE& sep, diskpos_t right, bool skew) {
+    if (depth < 0) {
+        internal_page_t newr;
+        newr.size_ = 2;
+        newr.set_sep(0, sep);
+        newr.ch_[0] = root_;
+        newr.ch_[1] = right;
+        root_ = internals_.insert_page(newr);
+        height_++;
         return;
     }
+    diskpos_t parent = path_[depth].pos_;
+    int idx = path_[depth].idx_;
+    auto f = internals_.get_page_mutable(parent);
+    for (int i = static_cast<int>(f->size_) - 2; i >= idx; i--) {
+        f->set_sep(i + 1, f->sep(i));
+    }
+    for (int i = static_cast<int>(f->size_) - 1; i > idx; i--) {
+        f->ch_[i + 1] = f->ch_[i];
+    }
+    f->set_sep(idx, sep);
+    f->ch_[idx + 1] = right;
+    f->size_++;
+    bool need_split = (f->size_ == internal_slot_count);
+    skew = skew && (idx + 2 == static_cast<int>(f->size_));
+    internals_.finish_use(parent);
+    if (need_split) {
+        split_internal(depth, skew);
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::split_leaf(diskpos_t pos, bool skew) {
+    auto cur = leaves_.get_page_mutable(pos);
+    leaf_page_t newp;
+    int half = split_point(cur->size_, skew, 1);
+    newp.size_ = cur->size_ - half;
+    for (int i = 0; i < static_cast<int>(newp.size_); i++) {
+        newp.set(i, cur->at(i + half));
+    }
+    cur->size_ = half;
+    newp.right_ = cur->right_;
+    KEYPAIR_TYPE sep = cur->at(half - 1);
+    diskpos_t newp_pos = leaves_.insert_page(newp);
+    cur->right_ = newp_pos;
+    if (pos == last_leaf_) {
+        last_leaf_ = newp_pos;
+    }
+    leaves_.finish_use(pos);
+    insert_child(static_cast<int>(path_.size()) - 1, sep, newp_pos, skew);
+}
 
-    diskpos_t newp_pos = buffer_.insert_page(newp);
-    auto newp_mut = buffer_.get_page_mutable(newp_pos);
-    for (int i = 0; i < newp_mut->size_; i++) {
-        newp_mut->data_[i] = cur_mut->data_[i + newp_mut->size_];
-        newp_mut->ch_[i] = cur_mut->ch_[i + newp_mut->size_];
-    }
-    for (int i = 0; i < newp_mut->size_; i++) {
-        auto ch = buffer_.get_page_mutable(newp_mut->ch_[i]);
-        ch->fa_ = newp_pos;
-        buffer_.finish_use(newp_mut->ch_[i]);
-    }
-    KEYPAIR_TYPE split_at = cur_mut->back();
-    KEYPAIR_TYPE max_pair = newp_mut->back();
-    if (parent_pos != -1) {
-        auto f = buffer_.get_page_mutable(parent_pos);
-        diskpos_t fa_pos = f->lower_bound(max_pair);
-        for (int i = f->size_ - 1; i >= fa_pos; i--) {
-            f->data_[i + 1] = f->data_[i];
-            f->ch_[i + 1] = f->ch_[i];
-        }
-        f->data_[fa_pos] = split_at;
-        f->data_[fa_pos + 1] = max_pair;
-        f->ch_[fa_pos] = cur_pos;
-        f->ch_[fa_pos + 1] = newp_pos;
-        f->size_++;
-        if (cur_mut->right_ != -1) {
-            auto rp = buffer_.get_page_mutable(cur_mut->right_);
-            rp->left_ = newp_pos;
-            buffer_.finish_use(cur_mut->right_);
-        }
-        cur_mut->right_ = newp_pos;
-        bool need_split_parent = (f->size_ == PAGE_SLOT_COUNT);
-        buffer_.finish_use(parent_pos);
-        buffer_.finish_use(cur_pos);
-        buffer_.finish_use(newp_pos);
-        if (need_split_parent) {
-            pos_ = parent_pos;
-            split();
-        }
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::split_internal(int depth, bool skew) {
+    diskpos_t pos = path_[depth].pos_;
+    auto cur = internals_.get_page_mutable(pos);
+    internal_page_t newp;
+    int half = split_point(cur->size_, skew, 2);
+    newp.size_ = cur->size_ - half;
+    for (int i = 0; i < static_cast<int>(newp.size_); i++) {
+        newp.ch_[i] = cur->ch_[i + half];
     }
-    else {
-        PAGE_TYPE newr;
-        newr.type_ = PageType::Internal;
-        newr.size_ = 2;
-        newr.data_[0] = split_at;
-        newr.data_[1] = max_pair;
-        newr.ch_[0] = cur_pos;
-        newr.ch_[1] = newp_pos;
-        root_ = buffer_.insert_page(newr);
-        cur_mut->fa_ = root_;
-        newp_mut->fa_ = root_;
-        buffer_.finish_use(cur_pos);
-        buffer_.finish_use(newp_pos);
+    for (int i = 0; i < static_cast<int>(newp.size_) - 1; i++) {
+        newp.set_sep(i, cur->sep(i + half));
     }
+    KEYPAIR_TYPE sep = cur->sep(half - 1);
+    cur->size_ = half;
+    diskpos_t newp_pos = internals_.insert_page(newp);
+    internals_.finish_use(pos);
+    insert_child(depth - 1, sep, newp_pos, skew);
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::insert(const KeyType& key, const ValueType& val) {
+bool BPT_TYPE::insert(const KeyType& key, const ValueType& val) {
     KEYPAIR_TYPE kp(key, val);
     if (root_ == 0) {
-        PAGE_TYPE newr;
+        leaf_page_t newr;
         newr.size_ = 1;
-        newr.type_ = PageType::Leaf;
-        newr.data_[0] = kp;
-        root_ = buffer_.insert_page(newr);
-        return;
+        newr.set(0, kp);
+        root_ = leaves_.insert_page(newr);
+        height_ = 1;
+        filter_add(key);
+        return true;
     }
-    pos_ = root_;
-    cur_ = buffer_.get_page(pos_);
-    while (cur_->type_ != PageType::Leaf) {
-        auto cur_mut = buffer_.get_page_mutable(pos_);
-        int k = cur_mut->lower_bound(kp);
-        if (cur_mut->data_[k] < kp) {
-            cur_mut->data_[k] = kp;
-        }
-        diskpos_t child = cur_mut->ch_[k];
-        buffer_.finish_use(pos_);
-        pos_ = child;
-        cur_ = buffer_.get_page(pos_);
-    }
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    int k = cur_mut->lower_bound(kp);
-    if (cur_mut->data_[k] == kp) {
-        buffer_.finish_use(pos_);
-        return;
+    // a pair above everything in the tree goes straight to the rightmost leaf
+    diskpos_t pos = rightmost_leaf();
+    int k;
+    auto last = leaves_.get_page(pos);
+    if (before(last->at(last->size_ - 1), kp)) {
+        k = static_cast<int>(last->size_);
     }
-    if (cur_mut->data_[k] < kp) {
-        cur_mut->data_[k + 1] = kp;
-        cur_mut->size_++;
+    else if (locate(kp, pos, k)) {
+        return false;
     }
-    else {
-        for (int i = static_cast<int>(cur_mut->size_) - 1; i >= k; i--) {
-            cur_mut->data_[i + 1] = cur_mut->data_[i];
+    else if constexpr (unique) {
+        // the key may be there with another value, which lower_bound puts just around k
+        auto leaf = leaves_.get_page(pos);
+        if ((k < static_cast<int>(leaf->size_) && leaf->keys_[k] == key) || (k > 0 && leaf->keys_[k - 1] == key)) {
+            return false;
         }
-        cur_mut->data_[k] = kp;
-        cur_mut->size_++;
     }
-    bool need_split = (cur_mut->size_ == PAGE_SLOT_COUNT);
-    buffer_.finish_use(pos_);
+    auto cur = leaves_.get_page_mutable(pos);
+    for (int i = static_cast<int>(cur->size_) - 1; i >= k; i--) {
+        cur->set(i + 1, cur->at(i));
+    }
+    cur->set(k, kp);
+    cur->size_++;
+    bool need_split = leaf_overflow(*cur);
+    bool append = (pos == last_leaf_ && k + 1 == static_cast<int>(cur->size_));
+    leaves_.finish_use(pos);
     if (need_split) {
-        split();
+        if (append) {
+            // the fast path skipped the descent, so record the rightmost path now
+            descend_rightmost();
+        }
+        split_leaf(pos, append);
     }
+    filter_add(key);
+    return true;
 }
 
 BPT_TEMPLATE_ARGS
@@ -303,259 +601,446 @@ void BPT_TYPE::erase(const KeyType& key, const ValueType& val) {
     if (root_ == 0) {
         return;
     }
-    KEYPAIR_TYPE kp(key, val);
-    pos_ = root_;
-    cur_ = buffer_.get_page(pos_);
-    while (cur_->type_ != PageType::Leaf) {
-        int k = cur_->lower_bound(kp);
-        pos_ = cur_->ch_[k];
-        cur_ = buffer_.get_page(pos_);
-    }
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    int k = cur_mut->lower_bound(kp);
-    if (cur_mut->data_[k] != kp) {
-        buffer_.finish_use(pos_);
+    diskpos_t pos;
+    int k;
+    if (!locate(KEYPAIR_TYPE(key, val), pos, k)) {
         return;
     }
-    for (int i = k; i < static_cast<int>(cur_mut->size_) - 1; i++) {
-        cur_mut->data_[i] = cur_mut->data_[i + 1];
-    }
-    cur_mut->size_--;
-    KEYPAIR_TYPE max_pair = cur_mut->back();
-    diskpos_t cur_pos = pos_;
-    diskpos_t fpos = cur_mut->fa_;
-    buffer_.finish_use(cur_pos);
-    while (fpos != -1) {
-        auto f = buffer_.get_page_mutable(fpos);
-        int p = f->lower_bound(kp);
-        diskpos_t next_parent = f->fa_;
-        if (f->data_[p] == kp) {
-            f->data_[p] = max_pair;
-            buffer_.finish_use(fpos);
-            fpos = next_parent;
+    auto cur = leaves_.get_page_mutable(pos);
+    for (int i = k; i < static_cast<int>(cur->size_) - 1; i++) {
+        cur->set(i, cur->at(i + 1));
+    }
+    cur->size_--;
+    size_t size = cur->size_;
+    bool underflow = leaf_underflow(*cur);
+    leaves_.finish_use(pos);
+    if (height_ == 1) {
+        if (size == 0) {
+            leaves_.delete_page(pos);
+            root_ = 0;
+            height_ = 0;
+            last_leaf_ = -1;
         }
-        else {
-            buffer_.finish_use(fpos);
+        return;
+    }
+    if (!underflow) {
+        return;
+    }
+    // only an empty leaf has to go at once, the others wait for the batch
+    if (size == 0) {
+        balance_leaf();
+        return;
+    }
+    underfull_.push_back(KEYPAIR_TYPE(key, val));
+    if (underfull_.size() >= BALANCE_BATCH) {
+        rebalance();
+    }
+}
+
+// leaves refill or merge below fill of their slots, at most half
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::set_merge_fill(double fill) {
+    merge_fill_ = std::min(std::max(fill, 0.0), 0.5);
+}
+
+/*
+    Rebalances the leaves erase left underfull. Each is found again by the
+    pair erased from it, which still routes to the leaf covering its place
+    however the leaves around it changed meanwhile.
+*/
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::rebalance() {
+    for (const KEYPAIR_TYPE& kp : underfull_) {
+        if (height_ <= 1) {
             break;
         }
+        diskpos_t pos;
+        int k;
+        locate(kp, pos, k);
+        if (leaf_underflow(*leaves_.get_page(pos))) {
+            balance_leaf();
+        }
     }
-    auto check_cur = buffer_.get_page(pos_);
-    bool need_balance = (check_cur->size_ < PAGE_SLOT_COUNT / 2);
-    if (need_balance) {
-        balance();
+    underfull_.clear();
+}
+
+// takes an already unlinked leaf out of its parent, first is a pair it held
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::remove_leaf(diskpos_t pos, const KEYPAIR_TYPE& first) {
+    if (height_ == 1) {
+        leaves_.delete_page(pos);
+        root_ = 0;
+        height_ = 0;
+        return;
     }
+    diskpos_t cur = find_leaf(first);
+    while (cur != pos) {
+        if (!step_right(cur)) {
+            // the parent would keep pointing at a leaf no longer in the chain
+            throw std::logic_error("leaf " + std::to_string(pos) + " to remove is not in the tree");
+        }
+    }
+    int depth = static_cast<int>(path_.size()) - 1;
+    diskpos_t fpos = path_[depth].pos_;
+    int idx = path_[depth].idx_;
+    auto f = internals_.get_page_mutable(fpos);
+    // the separator above the leaf goes, or the one below for the last child
+    int sep = (idx + 1 < static_cast<int>(f->size_)) ? idx : idx - 1;
+    for (int i = sep; i < static_cast<int>(f->size_) - 2; i++) {
+        f->set_sep(i, f->sep(i + 1));
+    }
+    for (int i = idx; i < static_cast<int>(f->size_) - 1; i++) {
+        f->ch_[i] = f->ch_[i + 1];
+    }
+    f->size_--;
+    internals_.finish_use(fpos);
+    leaves_.delete_page(pos);
+    fix_internal(depth);
 }
 
+/*
+    Removes every pair with lo <= key <= hi and returns how many went.
+    Leaves lying wholly in the range are unlinked and dropped from their
+    parents without touching their entries; only the two boundary leaves
+    are trimmed, and those left underfull wait for the next rebalance like
+    the leaves of erase.
+*/
 BPT_TEMPLATE_ARGS
-bool BPT_TYPE::borrowl() {
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    if (cur_mut->fa_ == -1 || cur_mut->size_ == 0) {
-        buffer_.finish_use(cur_pos);
-        return false;
+size_t BPT_TYPE::erase_range(const KeyType& lo, const KeyType& hi) {
+    if (root_ == 0 || compare_key(lo, hi) > 0) {
+        return 0;
     }
-    diskpos_t fpos = cur_mut->fa_;
-    KEYPAIR_TYPE max_pair = cur_mut->back();
-    auto f = buffer_.get_page_mutable(fpos);
-    int k = f->lower_bound(max_pair);
+    diskpos_t cur = find_leaf(lo);
+    int k = leaves_.get_page(cur)->lower_bound(lo);
+    if (k == static_cast<int>(leaves_.get_page(cur)->size_)) {
+        if (!step_right(cur)) {
+            return 0;
+        }
+        k = 0;
+    }
+    // last leaf before the range that stays, its right link skips the dropped leaves
+    diskpos_t prev = cur;
     if (k == 0) {
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        return false;
+        sjtu::vector<PathNode> saved = path_;
+        prev = -1;
+        diskpos_t left = cur;
+        if (step_left(left)) {
+            prev = left;
+        }
+        path_ = saved;
     }
-    diskpos_t bpos = f->ch_[k - 1];
-    auto bro = buffer_.get_page_mutable(bpos);
-    if (bro->size_ <= PAGE_SLOT_COUNT / 2) {
-        buffer_.finish_use(bpos);
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        return false;
+    size_t erased = 0;
+    bool relink = false;
+    sjtu::vector<diskpos_t> dropped;
+    sjtu::vector<KEYPAIR_TYPE> dropped_firsts;
+    // a pair erased from each trimmed leaf left underfull
+    sjtu::vector<KEYPAIR_TYPE> trimmed;
+    while (cur != -1) {
+        auto leaf = leaves_.get_page_mutable(cur);
+        int size = static_cast<int>(leaf->size_);
+        int end = leaf->upper_bound(hi);
+        if (end <= k) {
+            leaves_.finish_use(cur);
+            break;
+        }
+        erased += end - k;
+        diskpos_t next = leaf->right_;
+        if (k == 0 && end == size) {
+            dropped.push_back(cur);
+            dropped_firsts.push_back(leaf->at(0));
+            relink = true;
+        }
+        else {
+            KEYPAIR_TYPE first_erased = leaf->at(k);
+            for (int i = end; i < size; i++) {
+                leaf->set(k + i - end, leaf->at(i));
+            }
+            leaf->size_ -= end - k;
+            if (leaf_underflow(*leaf)) {
+                trimmed.push_back(first_erased);
+            }
+            if (relink && prev != -1) {
+                leaves_.get_page_mutable(prev)->right_ = cur;
+                leaves_.finish_use(prev);
+            }
+            relink = false;
+            prev = cur;
+        }
+        leaves_.finish_use(cur);
+        if (end < size) {
+            break;
+        }
+        cur = next;
+        k = 0;
     }
-    for (int i = static_cast<int>(cur_mut->size_) - 1; i >= 0; i--) {
-        cur_mut->data_[i + 1] = cur_mut->data_[i];
-        cur_mut->ch_[i + 1] = cur_mut->ch_[i];
-    }
-    cur_mut->data_[0] = bro->back();
-    cur_mut->ch_[0] = bro->ch_[bro->size_ - 1];
-    cur_mut->size_++;
-    bro->size_--;
-    if (cur_mut->type_ == PageType::Internal) {
-        auto son = buffer_.get_page_mutable(cur_mut->ch_[0]);
-        son->fa_ = cur_pos;
-        buffer_.finish_use(cur_mut->ch_[0]);
-    }
-    f->data_[k - 1] = bro->back();
-    buffer_.finish_use(bpos);
-    buffer_.finish_use(fpos);
-    buffer_.finish_use(cur_pos);
-    return true;
+    if (relink && prev != -1) {
+        leaves_.get_page_mutable(prev)->right_ = cur;
+        leaves_.finish_use(prev);
+    }
+    last_leaf_ = -1;
+    for (size_t i = 0; i < dropped.size(); i++) {
+        remove_leaf(dropped[i], dropped_firsts[i]);
+    }
+    for (size_t i = 0; i < trimmed.size(); i++) {
+        underfull_.push_back(trimmed[i]);
+    }
+    if (underfull_.size() >= BALANCE_BATCH) {
+        rebalance();
+    }
+    return erased;
 }
 
+/*
+    Applies mutator to the stored value equal to val. The value is rewritten
+    in its slot while it still sorts between its neighbours; only a value
+    that moves is erased and inserted again. Returns false if val is absent
+    or the changed value collides with another entry.
+*/
 BPT_TEMPLATE_ARGS
-bool BPT_TYPE::borrowr() {
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    if (cur_mut->fa_ == -1 || cur_mut->size_ == 0) {
-        buffer_.finish_use(cur_pos);
+template<typename Mutator>
+bool BPT_TYPE::update(const KeyType& key, const ValueType& val, Mutator mutator) {
+    if (root_ == 0) {
         return false;
     }
-    diskpos_t fpos = cur_mut->fa_;
-    KEYPAIR_TYPE max_pair = cur_mut->back();
-    auto f = buffer_.get_page_mutable(fpos);
-    int k = f->lower_bound(max_pair);
-    if (k == static_cast<int>(f->size_) - 1) {
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
+    diskpos_t pos;
+    int k;
+    KEYPAIR_TYPE old_kp(key, val);
+    if (!locate(old_kp, pos, k)) {
         return false;
     }
-    diskpos_t bpos = f->ch_[k + 1];
-    auto bro = buffer_.get_page_mutable(bpos);
-    if (bro->size_ <= PAGE_SLOT_COUNT / 2) {
-        buffer_.finish_use(bpos);
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
+    auto leaf = leaves_.get_page_mutable(pos);
+    old_kp = leaf->at(k);
+    KEYPAIR_TYPE new_kp = old_kp;
+    mutator(new_kp.val_);
+    bool stays = (k > 0 ? before(leaf->at(k - 1), new_kp) : !before(new_kp, old_kp)) &&
+        (k + 1 < static_cast<int>(leaf->size_) ? before(new_kp, leaf->at(k + 1)) : !before(old_kp, new_kp));
+    if (stays) {
+        leaf->vals_[k] = new_kp.val_;
+        // a compressed leaf may outgrow its page when a value changes
+        bool need_split = leaf_overflow(*leaf);
+        leaves_.finish_use(pos);
+        if (need_split) {
+            split_leaf(pos, false);
+        }
+        return true;
+    }
+    leaves_.finish_use(pos);
+    if (find(key, new_kp.val_).has_value()) {
         return false;
     }
-    cur_mut->data_[cur_mut->size_] = bro->data_[0];
-    cur_mut->ch_[cur_mut->size_] = bro->ch_[0];
-    cur_mut->size_++;
-    for (int i = 0; i < static_cast<int>(bro->size_) - 1; i++) {
-        bro->data_[i] = bro->data_[i + 1];
-        bro->ch_[i] = bro->ch_[i + 1];
-    }
-    bro->size_--;
-    if (cur_mut->type_ == PageType::Internal) {
-        auto son = buffer_.get_page_mutable(cur_mut->ch_[cur_mut->size_ - 1]);
-        son->fa_ = cur_pos;
-        buffer_.finish_use(cur_mut->ch_[cur_mut->size_ - 1]);
-    }
-    f->data_[k] = cur_mut->back();
-    buffer_.finish_use(bpos);
-    buffer_.finish_use(fpos);
-    buffer_.finish_use(cur_pos);
+    erase(key, old_kp.val_);
+    insert(key, new_kp.val_);
     return true;
 }
 
+/*
+    Overwrites the stored value equal to val, or inserts it; returns true on
+    insertion. With unique keys the key's value is overwritten whatever it is.
+*/
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::merge() {
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    if (cur_mut->fa_ == -1) {
-        buffer_.finish_use(cur_pos);
-        return;
-    }
-    KEYPAIR_TYPE max_pair = cur_mut->back();
-    diskpos_t fpos = cur_mut->fa_;
-    auto f = buffer_.get_page_mutable(fpos);
-    int k = f->lower_bound(max_pair);
-    if (k) {
-        diskpos_t bpos = f->ch_[k - 1];
-        auto bro = buffer_.get_page_mutable(bpos);
-        if (cur_mut->type_ == PageType::Internal) {
-            for (int i = 0; i < static_cast<int>(cur_mut->size_); i++) {
-                auto son = buffer_.get_page_mutable(cur_mut->ch_[i]);
-                son->fa_ = bpos;
-                buffer_.finish_use(cur_mut->ch_[i]);
-            }
+bool BPT_TYPE::upsert(const KeyType& key, const ValueType& val) {
+    ValueType stored = val;
+    if constexpr (unique) {
+        auto found = find(key);
+        if (found.has_value()) {
+            stored = found.value();
         }
-        for (int i = 0; i < static_cast<int>(cur_mut->size_); i++) {
-            bro->data_[bro->size_ + i] = cur_mut->data_[i];
-            bro->ch_[bro->size_ + i] = cur_mut->ch_[i];
+    }
+    if (update(key, stored, [&val](ValueType& v) { v = val; })) {
+        return false;
+    }
+    return insert(key, val);
+}
+
+/*
+    Pairs the underfull leaf reached by the last descent (the child taken
+    at the end of path_) with its left sibling, or its right one if it is
+    the first child. The two are merged when the result leaves room for a
+    merge_fill_ share of new entries, or when an even split would still be
+    underfull; otherwise entries move over until both hold about as many.
+    An empty page of the pair is always merged away, as a compressed leaf
+    may not take a single entry over and would be left empty.
+*/
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::balance_leaf() {
+    int depth = static_cast<int>(path_.size()) - 1;
+    diskpos_t fpos = path_[depth].pos_;
+    int idx = path_[depth].idx_;
+    auto f = internals_.get_page_mutable(fpos);
+    int left_idx = (idx > 0) ? idx - 1 : idx;
+    diskpos_t lpos = f->ch_[left_idx];
+    diskpos_t rpos = f->ch_[left_idx + 1];
+    auto lp = leaves_.get_page_mutable(lpos);
+    auto rp = leaves_.get_page_mutable(rpos);
+    size_t total = lp->size_ + rp->size_;
+    bool merge = total < leaf_slot_count &&
+        (total <= leaf_slot_count * (1 - merge_fill_) || total / 2 < leaf_slot_count * merge_fill_) &&
+        leaf_can_merge(*lp, *rp);
+    if (merge || lp->size_ == 0 || rp->size_ == 0) {
+        // merge the right page of the pair into the left one
+        for (int i = 0; i < static_cast<int>(rp->size_); i++) {
+            lp->set(lp->size_ + i, rp->at(i));
         }
-        bro->size_ += cur_mut->size_;
-        cur_mut->size_ = 0;
-        bro->right_ = cur_mut->right_;
-        if (cur_mut->right_ != -1) {
-            auto rp = buffer_.get_page_mutable(cur_mut->right_);
-            rp->left_ = bpos;
-            buffer_.finish_use(cur_mut->right_);
+        lp->size_ += rp->size_;
+        rp->size_ = 0;
+        lp->right_ = rp->right_;
+        for (int i = left_idx; i < static_cast<int>(f->size_) - 2; i++) {
+            f->set_sep(i, f->sep(i + 1));
         }
-        for (int i = k; i < static_cast<int>(f->size_) - 1; i++) {
-            f->data_[i] = f->data_[i + 1];
+        for (int i = left_idx + 1; i < static_cast<int>(f->size_) - 1; i++) {
             f->ch_[i] = f->ch_[i + 1];
         }
         f->size_--;
-        f->data_[k - 1] = bro->back();
-        bool need_balance = (f->size_ < PAGE_SLOT_COUNT / 2);
-        buffer_.finish_use(bpos);
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        buffer_.delete_page(cur_pos);
-        if (need_balance) {
-            pos_ = fpos;
-            balance();
-        }
-    }
-    else if (k != static_cast<int>(f->size_) - 1) {
-        diskpos_t bpos = f->ch_[k + 1];
-        auto bro = buffer_.get_page_mutable(bpos);
-        if (cur_mut->type_ == PageType::Internal) {
-            for (int i = 0; i < static_cast<int>(bro->size_); i++) {
-                auto son = buffer_.get_page_mutable(bro->ch_[i]);
-                son->fa_ = cur_pos;
-                buffer_.finish_use(bro->ch_[i]);
-            }
+        leaves_.finish_use(lpos);
+        leaves_.finish_use(rpos);
+        internals_.finish_use(fpos);
+        leaves_.delete_page(rpos);
+        if (rpos == last_leaf_) {
+            last_leaf_ = lpos;
         }
-        for (int i = 0; i < static_cast<int>(bro->size_); i++) {
-            cur_mut->data_[cur_mut->size_ + i] = bro->data_[i];
-            cur_mut->ch_[cur_mut->size_ + i] = bro->ch_[i];
-        }
-        cur_mut->size_ += bro->size_;
-        bro->size_ = 0;
-        cur_mut->right_ = bro->right_;
-        if (bro->right_ != -1) {
-            auto rp = buffer_.get_page_mutable(bro->right_);
-            rp->left_ = cur_pos;
-            buffer_.finish_use(bro->right_);
+        fix_internal(depth);
+        return;
+    }
+    int moved;
+    if (lp->size_ < rp->size_) {
+        moved = static_cast<int>(rp->size_ - lp->size_) / 2;
+        for (int i = 0; i < moved; i++) {
+            lp->set(lp->size_ + i, rp->at(i));
         }
-        for (int i = k + 1; i < static_cast<int>(f->size_) - 1; i++) {
-            f->data_[i] = f->data_[i + 1];
-            f->ch_[i] = f->ch_[i + 1];
+        lp->size_ += moved;
+        // a compressed leaf may not take as many entries as a plain one
+        while (moved > 0 && leaf_overflow(*lp)) {
+            lp->size_--;
+            moved--;
         }
-        f->size_--;
-        f->data_[k] = cur_mut->back();
-        bool need_balance = (f->size_ < PAGE_SLOT_COUNT / 2);
-        buffer_.finish_use(bpos);
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
-        buffer_.delete_page(bpos);
-        if (need_balance) {
-            pos_ = fpos;
-            balance();
+        for (int i = moved; i < static_cast<int>(rp->size_); i++) {
+            rp->set(i - moved, rp->at(i));
         }
+        rp->size_ -= moved;
     }
     else {
-        buffer_.finish_use(fpos);
-        buffer_.finish_use(cur_pos);
+        moved = static_cast<int>(lp->size_ - rp->size_) / 2;
+        for (int i = static_cast<int>(rp->size_) - 1; i >= 0; i--) {
+            rp->set(i + moved, rp->at(i));
+        }
+        for (int i = 0; i < moved; i++) {
+            rp->set(i, lp->at(lp->size_ - moved + i));
+        }
+        rp->size_ += moved;
+        lp->size_ -= moved;
+        while (moved > 0 && leaf_overflow(*rp)) {
+            for (int i = 0; i < static_cast<int>(rp->size_) - 1; i++) {
+                rp->set(i, rp->at(i + 1));
+            }
+            rp->size_--;
+            lp->size_++;
+            moved--;
+        }
     }
+    if (moved > 0) {
+        f->set_sep(left_idx, lp->at(lp->size_ - 1));
+    }
+    leaves_.finish_use(lpos);
+    leaves_.finish_use(rpos);
+    internals_.finish_use(fpos);
 }
 
 BPT_TEMPLATE_ARGS
-void BPT_TYPE::balance() {
-    auto cur_mut = buffer_.get_page_mutable(pos_);
-    diskpos_t cur_pos = pos_;
-    if (cur_mut->fa_ == -1) {
-        if (cur_mut->size_ == 0) {
-            root_ = 0;
+void BPT_TYPE::balance_internal(int depth) {
+    diskpos_t pos = path_[depth].pos_;
+    diskpos_t fpos = path_[depth - 1].pos_;
+    int idx = path_[depth - 1].idx_;
+    auto cur = internals_.get_page_mutable(pos);
+    auto f = internals_.get_page_mutable(fpos);
+    if (idx > 0) {
+        diskpos_t bpos = f->ch_[idx - 1];
+        auto bro = internals_.get_page_mutable(bpos);
+        if (bro->size_ > internal_slot_count / 2) {
+            for (int i = static_cast<int>(cur->size_) - 2; i >= 0; i--) {
+                cur->set_sep(i + 1, cur->sep(i));
+            }
+            for (int i = static_cast<int>(cur->size_) - 1; i >= 0; i--) {
+                cur->ch_[i + 1] = cur->ch_[i];
+            }
+            cur->ch_[0] = bro->ch_[bro->size_ - 1];
+            cur->set_sep(0, f->sep(idx - 1));
+            f->set_sep(idx - 1, bro->sep(bro->size_ - 2));
+            cur->size_++;
+            bro->size_--;
+            internals_.finish_use(bpos);
+            internals_.finish_use(fpos);
+            internals_.finish_use(pos);
+            return;
         }
-        if (cur_mut->type_ == PageType::Internal && cur_mut->size_ == 1) {
-            diskpos_t child = cur_mut->ch_[0];
-            auto son = buffer_.get_page_mutable(child);
-            son->fa_ = -1;
-            buffer_.finish_use(child);
-            root_ = child;
+        internals_.finish_use(bpos);
+    }
+    if (idx < static_cast<int>(f->size_) - 1) {
+        diskpos_t bpos = f->ch_[idx + 1];
+        auto bro = internals_.get_page_mutable(bpos);
+        if (bro->size_ > internal_slot_count / 2) {
+            cur->set_sep(cur->size_ - 1, f->sep(idx));
+            cur->ch_[cur->size_] = bro->ch_[0];
+            cur->size_++;
+            f->set_sep(idx, bro->sep(0));
+            for (int i = 0; i < static_cast<int>(bro->size_) - 2; i++) {
+                bro->set_sep(i, bro->sep(i + 1));
+            }
+            for (int i = 0; i < static_cast<int>(bro->size_) - 1; i++) {
+                bro->ch_[i] = bro->ch_[i + 1];
+            }
+            bro->size_--;
+            internals_.finish_use(bpos);
+            internals_.finish_use(fpos);
+            internals_.finish_use(pos);
+            return;
         }
-        buffer_.finish_use(cur_pos);
-        return;
+        internals_.finish_use(bpos);
     }
-    buffer_.finish_use(cur_pos);
-    if (borrowl()) {
-        return;
+    // merge the right page of the pair into the left one, pulling the separator down
+    int left_idx = (idx > 0) ? idx - 1 : idx;
+    diskpos_t lpos = f->ch_[left_idx];
+    diskpos_t rpos = f->ch_[left_idx + 1];
+    auto lp = (lpos == pos) ? cur : internals_.get_page_mutable(lpos);
+    auto rp = (rpos == pos) ? cur : internals_.get_page_mutable(rpos);
+    int base = static_cast<int>(lp->size_);
+    lp->set_sep(base - 1, f->sep(left_idx));
+    for (int i = 0; i < static_cast<int>(rp->size_) - 1; i++) {
+        lp->set_sep(base + i, rp->sep(i));
+    }
+    for (int i = 0; i < static_cast<int>(rp->size_); i++) {
+        lp->ch_[base + i] = rp->ch_[i];
+    }
+    lp->size_ += rp->size_;
+    rp->size_ = 0;
+    for (int i = left_idx; i < static_cast<int>(f->size_) - 2; i++) {
+        f->set_sep(i, f->sep(i + 1));
     }
-    if (borrowr()) {
+    for (int i = left_idx + 1; i < static_cast<int>(f->size_) - 1; i++) {
+        f->ch_[i] = f->ch_[i + 1];
+    }
+    f->size_--;
+    internals_.finish_use(lpos);
+    internals_.finish_use(rpos);
+    internals_.finish_use(fpos);
+    internals_.delete_page(rpos);
+    fix_internal(depth - 1);
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::fix_internal(int depth) {
+    diskpos_t pos = path_[depth].pos_;
+    auto page = internals_.get_page(pos);
+    if (depth == 0) {
+        if (page->size_ == 1) {
+            root_ = page->ch_[0];
+            height_--;
+            internals_.delete_page(pos);
+        }
         return;
     }
-    merge();
+    if (page->size_ < internal_slot_count / 2) {
+        balance_internal(depth);
+    }
 }
 
 BPT_TEMPLATE_ARGS
@@ -565,37 +1050,431 @@ void BPT_TYPE::serialize(sjtu::vector<ValueType>& vec) {
         return;
     }
     diskpos_t cur_pos = root_;
-    auto page = buffer_.get_page(cur_pos);
-    while (page->type_ != PageType::Leaf) {
-        cur_pos = page->ch_[0];
-        page = buffer_.get_page(cur_pos);
+    for (int level = height_; level > 1; level--) {
+        cur_pos = internals_.get_page(cur_pos)->ch_[0];
     }
-    while (true) {
+    while (cur_pos != -1) {
+        auto page = leaves_.get_page(cur_pos);
         for (int i = 0; i < static_cast<int>(page->size_); i++) {
-            vec.push_back(page->data_[i].val_);
-        }
-        if (page->right_ == -1) {
-            break;
+            vec.push_back(page->vals_[i]);
         }
         cur_pos = page->right_;
-        page = buffer_.get_page(cur_pos);
     }
 }
 
 BPT_TEMPLATE_ARGS
 void BPT_TYPE::flush() {
-    buffer_.set_root_pos(root_);
-    buffer_.flush();
-    cur_.reset();
-    pos_ = 0;
+    rebalance();
+    leaves_.set_info(root_info, root_);
+    internals_.set_info(height_info, height_);
+    leaves_.flush();
+    internals_.flush();
+    if (filtered_) {
+        bloom_.flush();
+    }
 }
 
 BPT_TEMPLATE_ARGS
 void BPT_TYPE::clear() {
-    buffer_.clear();
-    cur_.reset();
-    pos_ = 0;
+    leaves_.clear();
+    internals_.clear();
     root_ = 0;
+    height_ = 0;
+    last_leaf_ = -1;
+    underfull_.clear();
+    if (filtered_) {
+        bloom_.reset(0);
+    }
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::filter_add(const KeyType& key) {
+    if (!filtered_) {
+        return;
+    }
+    bloom_.add(key);
+    if (bloom_.full()) {
+        rebuild_filter();
+    }
+}
+
+// refills the filter from the leaves, with room for as many keys again
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::rebuild_filter() {
+    diskpos_t first = -1;
+    if (root_ != 0) {
+        first = root_;
+        for (int level = height_; level > 1; level--) {
+            first = internals_.get_page(first)->ch_[0];
+        }
+    }
+    size_t keys = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            bloom_.reset(keys * 2);
+        }
+        diskpos_t cur_pos = first;
+        std::optional<KeyType> prev;
+        while (cur_pos != -1) {
+            auto page = leaves_.get_page(cur_pos);
+            for (int i = 0; i < static_cast<int>(page->size_); i++) {
+                if (prev.has_value() && prev.value() == page->keys_[i]) {
+                    continue;
+                }
+                prev = page->keys_[i];
+                if (pass == 0) {
+                    keys++;
+                }
+                else {
+                    bloom_.add(page->keys_[i]);
+                }
+            }
+            cur_pos = page->right_;
+        }
+    }
+}
+
+// writes the first count pairs of page as a new leaf after prev, and drops them from page
+BPT_TEMPLATE_ARGS
+diskpos_t BPT_TYPE::append_leaf(BufferManager<leaf_page_t, leaf_codec_t>& out, leaf_page_t& page, size_t count, diskpos_t prev) {
+    auto leaf = std::make_unique<leaf_page_t>();
+    for (int i = 0; i < static_cast<int>(count); i++) {
+        leaf->set(i, page.at(i));
+    }
+    leaf->size_ = count;
+    diskpos_t pos = out.insert_page(*leaf);
+    if (prev != -1) {
+        out.get_page_mutable(prev)->right_ = pos;
+        out.finish_use(prev);
+    }
+    for (int i = static_cast<int>(count); i < static_cast<int>(page.size_); i++) {
+        page.set(i - static_cast<int>(count), page.at(i));
+    }
+    page.size_ -= count;
+    return pos;
+}
+
+/*
+    Rewrites the tree into new files: leaves are written in key order with
+    about fill of each page used, then the internal levels are built bottom
+    up over them. The new files are renamed over the old ones, so freed
+    pages are dropped and a scan reads the leaf file front to back.
+
+    The two renames cannot happen at once, so the new files carry the next
+    generation and the rename of the internal file is the commit point:
+    before it the old tree is intact, after it the constructor finishes an
+    interrupted switch by renaming the new leaf file as well. Returns false,
+    keeping the old tree, if the internal file could not be switched.
+*/
+BPT_TEMPLATE_ARGS
+bool BPT_TYPE::compact(double fill) {
+    flush();
+    fill = std::min(std::max(fill, 0.5), 1.0);
+    std::string tmp_name = file_name_ + ".compact.dat";
+    diskpos_t new_generation = internals_.get_info(generation_info) + 1;
+    diskpos_t new_root = 0;
+    int new_height = 0;
+    {
+        BufferManager<leaf_page_t, leaf_codec_t> new_leaves(CACHE_BYTES / sizeof(leaf_page_t), tmp_name);
+        BufferManager<internal_page_t> new_internals(CACHE_BYTES / page_bytes, tmp_name + ".internal.dat");
+        new_leaves.clear();
+        new_internals.clear();
+        sjtu::vector<diskpos_t> level;
+        sjtu::vector<KEYPAIR_TYPE> level_max;
+
+        size_t leaf_target = std::min(std::max(static_cast<size_t>(leaf_slot_count * fill), size_t(1)), leaf_slot_count - 1);
+        auto pending = std::make_unique<leaf_page_t>();
+        diskpos_t prev = -1;
+        auto emit = [&]() {
+            size_t count = pending->size_;
+            if constexpr (compressed) {
+                // keep the encoded leaf within the fill and leave room for an entry
+                size_t budget = std::min(static_cast<size_t>(page_bytes * fill), page_bytes - leaf_codec_t::max_entry_bytes);
+                size_t bytes = leaf_codec_t::encoded_size(*pending, count);
+                while (count > 1 && bytes > budget) {
+                    count = std::max(count * budget / bytes, size_t(1));
+                    bytes = leaf_codec_t::encoded_size(*pending, count);
+                }
+            }
+            level_max.push_back(pending->at(count - 1));
+            prev = append_leaf(new_leaves, *pending, count, prev);
+            level.push_back(prev);
+        };
+        diskpos_t pos = root_;
+        for (int i = height_; i > 1; i--) {
+            pos = internals_.get_page(pos)->ch_[0];
+        }
+        while (root_ != 0 && pos != -1) {
+            auto page = leaves_.get_page(pos);
+            for (int i = 0; i < static_cast<int>(page->size_); i++) {
+                pending->set(static_cast<int>(pending->size_), page->at(i));
+                pending->size_++;
+                if (pending->size_ == leaf_target) {
+                    emit();
+                }
+            }
+            pos = page->right_;
+        }
+        if (prev != -1 && pending->size_ > 0 && pending->size_ < leaf_target / 2) {
+            // even out the last two leaves instead of leaving a nearly empty one
+            auto last = new_leaves.get_page_mutable(prev);
+            size_t move = (last->size_ + pending->size_) / 2 - pending->size_;
+            for (int i = static_cast<int>(pending->size_) - 1; i >= 0; i--) {
+                pending->set(i + static_cast<int>(move), pending->at(i));
+            }
+            for (int i = 0; i < static_cast<int>(move); i++) {
+                pending->set(i, last->at(static_cast<int>(last->size_ - move) + i));
+            }
+            pending->size_ += move;
+            last->size_ -= move;
+            level_max[level_max.size() - 1] = last->at(last->size_ - 1);
+            new_leaves.finish_use(prev);
+        }
+        while (pending->size_ > 0) {
+            emit();
+        }
+        if (!level.empty()) {
+            new_height = 1;
+        }
+
+        size_t internal_target = std::min(std::max(static_cast<size_t>(internal_slot_count * fill), size_t(2)), internal_slot_count - 1);
+        while (level.size() > 1) {
+            // spread the children evenly, so no page of a level ends up nearly empty
+            size_t n = level.size();
+            size_t pages = (n + internal_target - 1) / internal_target;
+            sjtu::vector<diskpos_t> upper;
+            sjtu::vector<KEYPAIR_TYPE> upper_max;
+            size_t start = 0;
+            for (size_t p = 0; p < pages; p++) {
+                size_t count = n / pages + (p < n % pages ? 1 : 0);
+                internal_page_t page;
+                page.size_ = count;
+                for (size_t j = 0; j < count; j++) {
+                    page.ch_[j] = level[start + j];
+                    if (j + 1 < count) {
+                        page.set_sep(j, level_max[start + j]);
+                    }
+                }
+                upper.push_back(new_internals.insert_page(page));
+                upper_max.push_back(level_max[start + count - 1]);
+                start += count;
+            }
+            level = upper;
+            level_max = upper_max;
+            new_height++;
+        }
+        if (!level.empty()) {
+            new_root = level[0];
+        }
+        new_leaves.set_info(root_info, new_root);
+        new_internals.set_info(height_info, new_height);
+        new_leaves.set_info(generation_info, new_generation);
+        new_internals.set_info(generation_info, new_generation);
+        new_leaves.flush();
+        new_internals.flush();
+    }
+    if (!internals_.replace(tmp_name + ".internal.dat")) {
+        std::remove(tmp_name.c_str());
+        std::remove((tmp_name + ".internal.dat").c_str());
+        return false;
+    }
+    if (!leaves_.replace(tmp_name)) {
+        throw std::runtime_error("compaction of " + file_name_ + " stopped between its files, reopen it to finish");
+    }
+    root_ = new_root;
+    height_ = new_height;
+    last_leaf_ = -1;
+    path_.clear();
+    // erased keys linger in the filter, the rewrite is a good time to drop them
+    if (filtered_) {
+        rebuild_filter();
+    }
+    return true;
+}
+
+/*
+    Visits the subtree at pos, level counted from the root. Every pair of
+    the subtree has to lie within (lo, hi], the separators around it in the
+    parent (null at the ends of the tree).
+*/
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::check_page(diskpos_t pos, int level, const KEYPAIR_TYPE *lo, const KEYPAIR_TYPE *hi,
+    TreeStats& st, sjtu::vector<diskpos_t>& leaves) {
+    auto fail = [&st](const std::string& msg) {
+        if (st.valid_) {
+            st.valid_ = false;
+            st.error_ = msg;
+        }
+    };
+    auto out_of_range = [lo, hi](const KEYPAIR_TYPE& kp) {
+        return (lo && !before(*lo, kp)) || (hi && before(*hi, kp));
+    };
+    st.level_pages_[level]++;
+    if (level == height_ - 1) {
+        auto page = leaves_.get_page(pos);
+        leaves.push_back(pos);
+        st.entries_ += page->size_;
+        double fill = static_cast<double>(page->size_) / leaf_slot_count;
+        if constexpr (compressed) {
+            // whichever of the two limits the leaf is closer to
+            fill = std::max(fill, static_cast<double>(leaf_codec_t::encoded_size(*page)) / page_bytes);
+        }
+        st.avg_leaf_fill_ += fill;
+        st.min_leaf_fill_ = std::min(st.min_leaf_fill_, fill);
+        if (page->size_ == 0 || page->size_ >= leaf_slot_count) {
+            fail("leaf " + std::to_string(pos) + " has " + std::to_string(page->size_) + " entries");
+        }
+        for (int i = 0; i < static_cast<int>(page->size_); i++) {
+            if (i > 0 && !before(page->at(i - 1), page->at(i))) {
+                fail("leaf " + std::to_string(pos) + " is not sorted");
+            }
+            if (out_of_range(page->at(i))) {
+                fail("leaf " + std::to_string(pos) + " has a pair outside its separators");
+            }
+            if constexpr (leaf_page_t::use_prefix) {
+                if (page->prefix_[i] != page->keys_[i].prefix()) {
+                    fail("leaf " + std::to_string(pos) + " has a stale key prefix");
+                }
+            }
+        }
+        return;
+    }
+    auto page = internals_.get_page(pos);
+    double fill = static_cast<double>(page->size_) / internal_slot_count;
+    st.avg_internal_fill_ += fill;
+    st.min_internal_fill_ = std::min(st.min_internal_fill_, fill);
+    if (page->size_ == 0 || page->size_ >= internal_slot_count || (level == 0 && page->size_ < 2)) {
+        fail("internal page " + std::to_string(pos) + " has " + std::to_string(page->size_) + " children");
+        return;
+    }
+    for (int i = 0; i + 1 < static_cast<int>(page->size_); i++) {
+        if (i > 0 && !before(page->sep(i - 1), page->sep(i))) {
+            fail("internal page " + std::to_string(pos) + " is not sorted");
+        }
+        if (out_of_range(page->sep(i))) {
+            fail("internal page " + std::to_string(pos) + " has a separator outside its parent's");
+        }
+    }
+    for (int i = 0; i < static_cast<int>(page->size_); i++) {
+        KEYPAIR_TYPE child_lo, child_hi;
+        if (i > 0) {
+            child_lo = page->sep(i - 1);
+        }
+        if (i + 1 < static_cast<int>(page->size_)) {
+            child_hi = page->sep(i);
+        }
+        check_page(page->ch_[i], level + 1, (i > 0) ? &child_lo : lo,
+            (i + 1 < static_cast<int>(page->size_)) ? &child_hi : hi, st, leaves);
+    }
+}
+
+/*
+    Walks the whole tree once: collects the shape and fill of every level,
+    checks the order of keys against the separators, then follows the leaf
+    chain and checks that it visits the leaves in tree order.
+*/
+BPT_TEMPLATE_ARGS
+TreeStats BPT_TYPE::stats() {
+    TreeStats st;
+    st.height_ = height_;
+    if (root_ == 0) {
+        st.free_pages_ = leaves_.page_count() + internals_.page_count();
+        return st;
+    }
+    for (int i = 0; i < height_; i++) {
+        st.level_pages_.push_back(0);
+    }
+    st.min_leaf_fill_ = 1.0;
+    st.min_internal_fill_ = 1.0;
+    sjtu::vector<diskpos_t> leaves;
+    check_page(root_, 0, nullptr, nullptr, st, leaves);
+    size_t internal_pages = 0;
+    for (int i = 0; i + 1 < height_; i++) {
+        internal_pages += st.level_pages_[i];
+    }
+    st.avg_leaf_fill_ /= leaves.size();
+    if (internal_pages > 0) {
+        st.avg_internal_fill_ /= internal_pages;
+    }
+    else {
+        st.min_internal_fill_ = 0;
+    }
+    size_t leaf_file = leaves_.page_count();
+    size_t internal_file = internals_.page_count();
+    st.free_pages_ = (leaf_file > leaves.size() ? leaf_file - leaves.size() : 0) +
+        (internal_file > internal_pages ? internal_file - internal_pages : 0);
+
+    size_t sequential = 0;
+    diskpos_t pos = leaves[0];
+    KEYPAIR_TYPE last;
+    for (size_t i = 0; i < leaves.size(); i++) {
+        if (pos != leaves[i]) {
+            st.valid_ = false;
+            st.error_ = "leaf chain reaches " + std::to_string(pos) + " instead of " + std::to_string(leaves[i]);
+            break;
+        }
+        auto page = leaves_.get_page(pos);
+        if (i > 0 && !before(last, page->front())) {
+            st.valid_ = false;
+            st.error_ = "leaf " + std::to_string(pos) + " does not follow its left neighbour";
+            break;
+        }
+        last = page->back();
+        if (i + 1 < leaves.size() && page->right_ == pos + static_cast<diskpos_t>(leaves_.record_bytes)) {
+            sequential++;
+        }
+        pos = page->right_;
+    }
+    if (st.valid_ && pos != -1) {
+        st.valid_ = false;
+        st.error_ = "rightmost leaf links to " + std::to_string(pos);
+    }
+    if (st.valid_ && last_leaf_ != -1 && last_leaf_ != leaves[leaves.size() - 1]) {
+        st.valid_ = false;
+        st.error_ = "cached rightmost leaf is stale";
+    }
+    st.sequentiality_ = (leaves.size() > 1) ? static_cast<double>(sequential) / (leaves.size() - 1) : 1.0;
+    return st;
+}
+
+BPT_TEMPLATE_ARGS
+TreeSnapshot BPT_TYPE::snapshot() {
+    TreeSnapshot snap;
+    snap.leaf_epoch_ = leaves_.begin_snapshot();
+    snap.internal_epoch_ = internals_.begin_snapshot();
+    snap.root_ = root_;
+    snap.height_ = height_;
+    return snap;
+}
+
+BPT_TEMPLATE_ARGS
+void BPT_TYPE::release(const TreeSnapshot& snap) {
+    leaves_.end_snapshot(snap.leaf_epoch_);
+    internals_.end_snapshot(snap.internal_epoch_);
+}
+
+/*
+    Calls visit(key, val) on every pair of the snapshot in order. The walk
+    goes leaf by leaf through the page versions the snapshot sees, so visit
+    may write to the tree without the walk skipping or repeating a pair.
+*/
+BPT_TEMPLATE_ARGS
+template<typename Visitor>
+void BPT_TYPE::for_each(const TreeSnapshot& snap, Visitor visit) {
+    if (snap.root_ == 0) {
+        return;
+    }
+    diskpos_t pos = snap.root_;
+    for (int level = snap.height_; level > 1; level--) {
+        pos = internals_.get_page(pos, snap.internal_epoch_)->ch_[0];
+    }
+    while (pos != -1) {
+        auto leaf = leaves_.get_page(pos, snap.leaf_epoch_);
+        for (int i = 0; i < static_cast<int>(leaf->size_); i++) {
+            visit(leaf->keys_[i], leaf->vals_[i]);
+        }
+        pos = leaf->right_;
+    }
 }
 
 } // namespace sjtu
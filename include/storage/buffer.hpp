@@ -2,32 +2,68 @@
 #define BUFFER_HPP
 
 #include <memory>
+#include <type_traits>
 
 #include "../config.hpp"
-#include "page.hpp"
 #include "disk.hpp"
+#include "codec.hpp"
 #include "../stl/list.hpp"
 #include "../stl/unordered_map.hpp"
 #include "../stl/unordered_set.hpp"
+#include "../stl/vector.hpp"
 
 namespace sjtu {
-#define BUFFER_MANAGER_TYPE BufferManager<KeyType, ValueType>
-#define BUFFER_MANAGER_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
-
-BUFFER_MANAGER_TEMPLATE_ARGS
+#define BUFFER_MANAGER_TYPE BufferManager<FixedPage, Codec>
+#define BUFFER_MANAGER_TEMPLATE_ARGS template<typename FixedPage, typename Codec>
+
+/*
+    Cached pages are always kept decoded; Codec converts them to and from the
+    records stored in the file (see codec.hpp).
+
+    Snapshot reads: begin_snapshot opens a new epoch s, and get_page(pos, s)
+    returns the version of the page written before s was opened. While some
+    snapshot can still see a page, the first write to it copies the page and
+    keeps the old version in memory, and deleting it defers freeing the
+    slot. Old versions go once the last snapshot that sees them ends.
+*/
+template<typename FixedPage, typename Codec = PlainCodec<FixedPage>>
 class BufferManager {
 private:
     struct CacheEntry {
         diskpos_t pos_;
-        std::shared_ptr<PAGE_TYPE> page_;
+        std::shared_ptr<FixedPage> page_;
         bool dirty_;
         typename sjtu::list<diskpos_t>::iterator lru_it_;
+        // epoch in which this version of the page was written
+        size_t born_ = 0;
+    };
+    // a retired version, seen by the snapshots s with born_ < s <= died_
+    struct PageVersion {
+        size_t born_;
+        size_t died_;
+        std::shared_ptr<const FixedPage> page_;
     };
-    DiskManager<PAGE_TYPE> disk_;
+    typedef typename Codec::disk_type disk_page_t;
+    constexpr static bool plain = std::is_same_v<disk_page_t, FixedPage>;
+
+    DiskManager<disk_page_t> disk_;
     sjtu::unordered_map<diskpos_t, CacheEntry> cache_;
     sjtu::unordered_set<diskpos_t> cache_in_use_;
     sjtu::list<diskpos_t> lru_list_;
     size_t cache_capacity_;
+    size_t epoch_ = 0;
+    // epochs of the open snapshots
+    sjtu::unordered_set<size_t> snapshots_;
+    sjtu::unordered_map<diskpos_t, sjtu::vector<PageVersion>> versions_;
+    // epochs of pages dropped from the cache that some snapshot must not see
+    sjtu::unordered_map<diskpos_t, size_t> born_;
+    sjtu::vector<diskpos_t> deferred_frees_;
+
+    bool seen_by_snapshot(size_t born, size_t died) const;
+
+    void remember_born(diskpos_t pos, const CacheEntry& entry);
+
+    void reclaim();
 
     void evict();
 
@@ -35,8 +71,17 @@ private:
 
     void load(diskpos_t pos);
 
+    void read_page(FixedPage& page, diskpos_t pos);
+
+    void write_page(FixedPage& page, diskpos_t pos);
+
+    diskpos_t append_page(FixedPage& page);
+
 public:
-    BufferManager(size_t cache_capacity = CACHE_CAPACITY, const std::string& file_name = "default.dat");
+    // bytes one page takes in the file
+    constexpr static size_t record_bytes = sizeof(disk_page_t);
+
+    BufferManager(size_t cache_capacity = CACHE_BYTES / sizeof(FixedPage), const std::string& file_name = "default.dat");
 
     BufferManager(const BufferManager& oth) = delete;
 
@@ -44,19 +89,19 @@ public:
 
     BufferManager& operator=(const BufferManager& oth) = delete;
 
-    std::shared_ptr<const PAGE_TYPE> get_page(diskpos_t pos);
+    std::shared_ptr<const FixedPage> get_page(diskpos_t pos);
 
-    std::shared_ptr<PAGE_TYPE> get_page_mutable(diskpos_t pos);
+    std::shared_ptr<FixedPage> get_page_mutable(diskpos_t pos);
 
     void mark_dirty(diskpos_t pos);
 
-    diskpos_t insert_page(PAGE_TYPE& page);
+    diskpos_t insert_page(FixedPage& page);
 
     void flush();
 
-    diskpos_t get_root_pos();
+    diskpos_t get_info(int idx);
 
-    void set_root_pos(diskpos_t pos);
+    void set_info(int idx, diskpos_t info);
 
     void finish_use(diskpos_t pos);
 
@@ -64,6 +109,16 @@ public:
 
     void clear();
 
+    bool replace(const std::string& source);
+
+    size_t page_count();
+
+    size_t begin_snapshot();
+
+    void end_snapshot(size_t epoch);
+
+    std::shared_ptr<const FixedPage> get_page(diskpos_t pos, size_t epoch);
+
 };
 
 BUFFER_MANAGER_TEMPLATE_ARGS
@@ -87,8 +142,9 @@ void BUFFER_MANAGER_TYPE::evict() {
             auto it = cache_.find(cand);
             if (it != cache_.end()) {
                 if (it->second->dirty_) {
-                    disk_.update(*(it->second->page_), cand);
+                    write_page(*(it->second->page_), cand);
                 }
+                remember_born(cand, *it->second);
                 auto forward_it = rit.base();
                 --forward_it;
                 lru_list_.erase(forward_it);
@@ -111,47 +167,94 @@ void BUFFER_MANAGER_TYPE::promote(diskpos_t pos) {
 
 BUFFER_MANAGER_TEMPLATE_ARGS
 void BUFFER_MANAGER_TYPE::load(diskpos_t pos) {
-    auto page_ptr = std::make_shared<PAGE_TYPE>();
-    disk_.read(*page_ptr, pos);
+    auto page_ptr = std::make_shared<FixedPage>();
+    read_page(*page_ptr, pos);
     CacheEntry entry;
     entry.pos_ = pos;
     entry.page_ = page_ptr;
     entry.dirty_ = false;
+    auto born_it = born_.find(pos);
+    if (born_it != born_.end()) {
+        entry.born_ = *born_it->second;
+        born_.erase(pos);
+    }
     lru_list_.push_front(pos);
     entry.lru_it_ = lru_list_.begin();
     cache_[pos] = entry;
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-std::shared_ptr<const PAGE_TYPE> BUFFER_MANAGER_TYPE::get_page(diskpos_t pos) {
+void BUFFER_MANAGER_TYPE::read_page(FixedPage& page, diskpos_t pos) {
+    if constexpr (plain) {
+        disk_.read(page, pos);
+    }
+    else {
+        auto disk_page = std::make_unique<disk_page_t>();
+        disk_.read(*disk_page, pos);
+        Codec::decode(*disk_page, page);
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::write_page(FixedPage& page, diskpos_t pos) {
+    if constexpr (plain) {
+        disk_.update(page, pos);
+    }
+    else {
+        auto disk_page = std::make_unique<disk_page_t>();
+        Codec::encode(page, *disk_page);
+        disk_.update(*disk_page, pos);
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+diskpos_t BUFFER_MANAGER_TYPE::append_page(FixedPage& page) {
+    if constexpr (plain) {
+        return disk_.write(page);
+    }
+    else {
+        auto disk_page = std::make_unique<disk_page_t>();
+        Codec::encode(page, *disk_page);
+        return disk_.write(*disk_page);
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+std::shared_ptr<const FixedPage> BUFFER_MANAGER_TYPE::get_page(diskpos_t pos) {
     auto it = cache_.find(pos);
     if (it != cache_.end()) {
         promote(pos);
-        return std::const_pointer_cast<const PAGE_TYPE>(it->second->page_);
+        return std::const_pointer_cast<const FixedPage>(it->second->page_);
     }
     if (cache_.size() >= cache_capacity_) {
         evict();
     }
     load(pos);
-    return std::const_pointer_cast<const PAGE_TYPE>(cache_[pos].page_);
+    return std::const_pointer_cast<const FixedPage>(cache_[pos].page_);
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-std::shared_ptr<PAGE_TYPE> BUFFER_MANAGER_TYPE::get_page_mutable(diskpos_t pos) {
+std::shared_ptr<FixedPage> BUFFER_MANAGER_TYPE::get_page_mutable(diskpos_t pos) {
     auto it = cache_.find(pos);
     if (it != cache_.end()) {
         promote(pos);
-        mark_dirty(pos);
-        cache_in_use_.insert(pos);
-        return it->second->page_;
     }
-    if (cache_.size() >= cache_capacity_) {
-        evict();
+    else {
+        if (cache_.size() >= cache_capacity_) {
+            evict();
+        }
+        load(pos);
+    }
+    CacheEntry& entry = cache_[pos];
+    if (seen_by_snapshot(entry.born_, epoch_)) {
+        // copy on write, the snapshots keep reading the old version
+        versions_[pos].push_back(PageVersion{entry.born_, epoch_, entry.page_});
+        entry.page_ = std::make_shared<FixedPage>(*entry.page_);
+        entry.born_ = epoch_;
     }
-    load(pos);
     mark_dirty(pos);
     cache_in_use_.insert(pos);
-    return cache_[pos].page_;
+    return entry.page_;
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
@@ -163,16 +266,17 @@ void BUFFER_MANAGER_TYPE::mark_dirty(diskpos_t pos) {
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-diskpos_t BUFFER_MANAGER_TYPE::insert_page(Page<KeyType, ValueType> &page) {
+diskpos_t BUFFER_MANAGER_TYPE::insert_page(FixedPage& page) {
     if (cache_.size() >= cache_capacity_) {
         evict();
     }
-    diskpos_t pos = disk_.write(page);
-    std::shared_ptr<PAGE_TYPE> page_ptr = std::make_shared<PAGE_TYPE>(page);
+    diskpos_t pos = append_page(page);
+    std::shared_ptr<FixedPage> page_ptr = std::make_shared<FixedPage>(page);
     CacheEntry entry;
     entry.pos_ = pos;
     entry.page_ = page_ptr;
     entry.dirty_ = false;
+    entry.born_ = epoch_;
     lru_list_.push_front(pos);
     entry.lru_it_ = lru_list_.begin();
     cache_[pos] = entry;
@@ -183,9 +287,10 @@ BUFFER_MANAGER_TEMPLATE_ARGS
 void BUFFER_MANAGER_TYPE::flush() {
     for (auto& pair : cache_) {
         if (pair.second->dirty_) {
-            disk_.update(*(pair.second->page_), *pair.first);
+            write_page(*(pair.second->page_), *pair.first);
             pair.second->dirty_ = false;
         }
+        remember_born(*pair.first, *pair.second);
     }
     cache_.clear();
     lru_list_.clear();
@@ -193,15 +298,15 @@ void BUFFER_MANAGER_TYPE::flush() {
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-diskpos_t BUFFER_MANAGER_TYPE::get_root_pos() {
-    diskpos_t root_pos;
-    disk_.get_info(root_pos, 2);
-    return root_pos;
+diskpos_t BUFFER_MANAGER_TYPE::get_info(int idx) {
+    diskpos_t info = 0;
+    disk_.get_info(info, idx);
+    return info;
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
-void BUFFER_MANAGER_TYPE::set_root_pos(diskpos_t pos) {
-    disk_.write_info(pos, 2);
+void BUFFER_MANAGER_TYPE::set_info(int idx, diskpos_t info) {
+    disk_.write_info(info, idx);
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
@@ -211,7 +316,27 @@ void BUFFER_MANAGER_TYPE::finish_use(diskpos_t pos) {
 
 BUFFER_MANAGER_TEMPLATE_ARGS
 void BUFFER_MANAGER_TYPE::delete_page(diskpos_t pos) {
-    disk_.erase(pos);
+    if (!snapshots_.empty()) {
+        // the page stays readable for the snapshots that can still see it
+        auto page = get_page(pos);
+        size_t born = cache_[pos].born_;
+        if (seen_by_snapshot(born, epoch_)) {
+            versions_[pos].push_back(PageVersion{born, epoch_, page});
+        }
+    }
+    auto it = cache_.find(pos);
+    if (it != cache_.end()) {
+        lru_list_.erase(it->second->lru_it_);
+        cache_.erase(pos);
+    }
+    cache_in_use_.erase(pos);
+    born_.erase(pos);
+    if (versions_.find(pos) != versions_.end()) {
+        deferred_frees_.push_back(pos);
+    }
+    else {
+        disk_.erase(pos);
+    }
 }
 
 BUFFER_MANAGER_TEMPLATE_ARGS
@@ -220,6 +345,120 @@ void BUFFER_MANAGER_TYPE::clear() {
     cache_.clear();
     lru_list_.clear();
     cache_in_use_.clear();
+    snapshots_.clear();
+    versions_.clear();
+    born_.clear();
+    deferred_frees_.clear();
+}
+
+// drops the cache and the snapshots without writing back, call flush first to keep changes; false if the file stayed
+BUFFER_MANAGER_TEMPLATE_ARGS
+bool BUFFER_MANAGER_TYPE::replace(const std::string& source) {
+    cache_.clear();
+    lru_list_.clear();
+    cache_in_use_.clear();
+    snapshots_.clear();
+    versions_.clear();
+    born_.clear();
+    deferred_frees_.clear();
+    return disk_.replace(source);
+}
+
+// pages in use by the file, freed ones excluded
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::page_count() {
+    return disk_.record_count() - disk_.free_count();
+}
+
+// whether an open snapshot s has born < s <= died
+BUFFER_MANAGER_TEMPLATE_ARGS
+bool BUFFER_MANAGER_TYPE::seen_by_snapshot(size_t born, size_t died) const {
+    if (snapshots_.empty()) {
+        return false;
+    }
+    for (auto it = snapshots_.begin(); it != snapshots_.end(); ++it) {
+        if (born < *it->key && *it->key <= died) {
+            return true;
+        }
+    }
+    return false;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::remember_born(diskpos_t pos, const CacheEntry& entry) {
+    if (seen_by_snapshot(0, entry.born_)) {
+        born_[pos] = entry.born_;
+    }
+}
+
+// drops the versions no open snapshot sees, then frees the pages waiting on them
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::reclaim() {
+    sjtu::vector<diskpos_t> emptied;
+    for (auto it = versions_.begin(); it != versions_.end(); ++it) {
+        sjtu::vector<PageVersion>& list = *it->second;
+        sjtu::vector<PageVersion> kept;
+        for (size_t i = 0; i < list.size(); i++) {
+            if (seen_by_snapshot(list[i].born_, list[i].died_)) {
+                kept.push_back(list[i]);
+            }
+        }
+        list = kept;
+        if (list.empty()) {
+            emptied.push_back(*it->first);
+        }
+    }
+    for (size_t i = 0; i < emptied.size(); i++) {
+        versions_.erase(emptied[i]);
+    }
+    sjtu::vector<diskpos_t> waiting;
+    for (size_t i = 0; i < deferred_frees_.size(); i++) {
+        if (versions_.find(deferred_frees_[i]) != versions_.end()) {
+            waiting.push_back(deferred_frees_[i]);
+        }
+        else {
+            disk_.erase(deferred_frees_[i]);
+        }
+    }
+    deferred_frees_ = waiting;
+    sjtu::vector<diskpos_t> stale;
+    for (auto it = born_.begin(); it != born_.end(); ++it) {
+        if (!seen_by_snapshot(0, *it->second)) {
+            stale.push_back(*it->first);
+        }
+    }
+    for (size_t i = 0; i < stale.size(); i++) {
+        born_.erase(stale[i]);
+    }
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+size_t BUFFER_MANAGER_TYPE::begin_snapshot() {
+    epoch_++;
+    snapshots_.insert(epoch_);
+    return epoch_;
+}
+
+BUFFER_MANAGER_TEMPLATE_ARGS
+void BUFFER_MANAGER_TYPE::end_snapshot(size_t epoch) {
+    if (snapshots_.erase(epoch) > 0) {
+        reclaim();
+    }
+}
+
+// the version of pos that the snapshot of epoch sees
+BUFFER_MANAGER_TEMPLATE_ARGS
+std::shared_ptr<const FixedPage> BUFFER_MANAGER_TYPE::get_page(diskpos_t pos, size_t epoch) {
+    auto it = versions_.find(pos);
+    if (it != versions_.end()) {
+        const sjtu::vector<PageVersion>& list = *it->second;
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i].born_ < epoch && epoch <= list[i].died_) {
+                return list[i].page_;
+            }
+        }
+    }
+    return get_page(pos);
 }
 
 } // namespace sjtu
@@ -0,0 +1,222 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include "../config.hpp"
+#include "page.hpp"
+
+namespace sjtu {
+
+/*
+    Page codecs convert between the page kept in the buffer cache and the
+    record written to disk. PlainCodec stores the page as it is.
+*/
+template<typename Page>
+struct PlainCodec {
+    typedef Page disk_type;
+};
+
+// appends v in 7-bit groups, low group first; with out == nullptr only counts the bytes
+inline void put_varint(unsigned char *out, size_t& len, uint64_t v) {
+    while (v >= 0x80) {
+        if (out) {
+            out[len] = static_cast<unsigned char>(v | 0x80);
+        }
+        len++;
+        v >>= 7;
+    }
+    if (out) {
+        out[len] = static_cast<unsigned char>(v);
+    }
+    len++;
+}
+
+inline uint64_t get_varint(const unsigned char *in, size_t& len) {
+    uint64_t v = 0;
+    int shift = 0;
+    while (in[len] & 0x80) {
+        v |= static_cast<uint64_t>(in[len] & 0x7f) << shift;
+        shift += 7;
+        len++;
+    }
+    v |= static_cast<uint64_t>(in[len]) << shift;
+    len++;
+    return v;
+}
+
+#define COMPRESSED_LEAF_CODEC_TYPE CompressedLeafCodec<KeyType, ValueType, slot_count, page_bytes>
+#define COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS template<typename KeyType, typename ValueType, size_t slot_count, size_t page_bytes>
+
+/*
+    Compressed leaf format, decoded once when the page is loaded:
+
+        [size] [right link] [key #1] [value #1] ... [key #n] [value #n]
+
+    Integers are zigzag varints of the difference to the previous entry.
+    Other keys keep only the bytes they do not share with the previous key
+    (trailing zero padding is dropped), and values made of 32-bit words are
+    encoded word by word as deltas, so repeated fields cost one byte.
+
+    Keys are not decoded on demand: delta and suffix encoding make each key
+    depend on the one before it, so a lookup would have to decode up to its
+    slot anyway. The whole page is decoded on a cache miss instead, and hits
+    search the decoded page, which a hot page pays for only once.
+*/
+COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS
+struct CompressedLeafCodec {
+    typedef LeafPage<KeyType, ValueType, slot_count> page_type;
+
+    struct disk_type {
+        unsigned char data_[page_bytes];
+    };
+
+    // upper bound of one encoded entry, used to keep merges within the page
+    constexpr static size_t max_entry_bytes = sizeof(KeyType) + sizeof(ValueType) * 5 / 4 + 24;
+
+    static size_t encoded_size(const page_type& page, size_t size);
+
+    static size_t encoded_size(const page_type& page);
+
+    static void encode(const page_type& page, disk_type& disk);
+
+    static void decode(const disk_type& disk, page_type& page);
+
+private:
+    static size_t encode_to(const page_type& page, size_t size, unsigned char *out);
+
+    template<typename T>
+    static void put_field(unsigned char *out, size_t& len, const T& cur, const T& prev);
+
+    template<typename T>
+    static void get_field(const unsigned char *in, size_t& len, T& cur, const T& prev);
+};
+
+COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS
+template<typename T>
+void COMPRESSED_LEAF_CODEC_TYPE::put_field(unsigned char *out, size_t& len, const T& cur, const T& prev) {
+    if constexpr (std::is_integral_v<T>) {
+        int64_t delta = static_cast<int64_t>(static_cast<uint64_t>(cur) - static_cast<uint64_t>(prev));
+        put_varint(out, len, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+    }
+    else if constexpr (sizeof(T) % sizeof(int32_t) == 0) {
+        int32_t cur_words[sizeof(T) / sizeof(int32_t)];
+        int32_t prev_words[sizeof(T) / sizeof(int32_t)];
+        std::memcpy(cur_words, &cur, sizeof(T));
+        std::memcpy(prev_words, &prev, sizeof(T));
+        for (size_t i = 0; i < sizeof(T) / sizeof(int32_t); i++) {
+            put_field(out, len, cur_words[i], prev_words[i]);
+        }
+    }
+    else {
+        const unsigned char *cur_bytes = reinterpret_cast<const unsigned char *>(&cur);
+        const unsigned char *prev_bytes = reinterpret_cast<const unsigned char *>(&prev);
+        size_t cur_len = sizeof(T);
+        while (cur_len > 0 && cur_bytes[cur_len - 1] == 0) {
+            cur_len--;
+        }
+        size_t shared = 0;
+        while (shared < cur_len && cur_bytes[shared] == prev_bytes[shared]) {
+            shared++;
+        }
+        put_varint(out, len, shared);
+        put_varint(out, len, cur_len - shared);
+        if (out) {
+            std::memcpy(out + len, cur_bytes + shared, cur_len - shared);
+        }
+        len += cur_len - shared;
+    }
+}
+
+COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS
+template<typename T>
+void COMPRESSED_LEAF_CODEC_TYPE::get_field(const unsigned char *in, size_t& len, T& cur, const T& prev) {
+    if constexpr (std::is_integral_v<T>) {
+        uint64_t zz = get_varint(in, len);
+        int64_t delta = static_cast<int64_t>(zz >> 1) ^ -static_cast<int64_t>(zz & 1);
+        cur = static_cast<T>(static_cast<uint64_t>(prev) + static_cast<uint64_t>(delta));
+    }
+    else if constexpr (sizeof(T) % sizeof(int32_t) == 0) {
+        int32_t cur_words[sizeof(T) / sizeof(int32_t)];
+        int32_t prev_words[sizeof(T) / sizeof(int32_t)];
+        std::memcpy(prev_words, &prev, sizeof(T));
+        for (size_t i = 0; i < sizeof(T) / sizeof(int32_t); i++) {
+            get_field(in, len, cur_words[i], prev_words[i]);
+        }
+        std::memcpy(static_cast<void *>(&cur), cur_words, sizeof(T));
+    }
+    else {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, &prev, sizeof(T));
+        size_t shared = get_varint(in, len);
+        size_t rest = get_varint(in, len);
+        std::memcpy(bytes + shared, in + len, rest);
+        std::memset(bytes + shared + rest, 0, sizeof(T) - shared - rest);
+        len += rest;
+        std::memcpy(static_cast<void *>(&cur), bytes, sizeof(T));
+    }
+}
+
+COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS
+size_t COMPRESSED_LEAF_CODEC_TYPE::encode_to(const page_type& page, size_t size, unsigned char *out) {
+    size_t len = 0;
+    put_varint(out, len, size);
+    put_field(out, len, page.right_, diskpos_t(0));
+    KeyType prev_key;
+    ValueType prev_val;
+    std::memset(static_cast<void *>(&prev_key), 0, sizeof(KeyType));
+    std::memset(static_cast<void *>(&prev_val), 0, sizeof(ValueType));
+    for (size_t i = 0; i < size; i++) {
+        put_field(out, len, page.keys_[i], prev_key);
+        put_field(out, len, page.vals_[i], prev_val);
+        prev_key = page.keys_[i];
+        prev_val = page.vals_[i];
+    }
+    return len;
+}
+
+// encoded size of the first size entries of page
+COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS
+size_t COMPRESSED_LEAF_CODEC_TYPE::encoded_size(const page_type& page, size_t size) {
+    return encode_to(page, size, nullptr);
+}
+
+COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS
+size_t COMPRESSED_LEAF_CODEC_TYPE::encoded_size(const page_type& page) {
+    return encode_to(page, page.size_, nullptr);
+}
+
+COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS
+void COMPRESSED_LEAF_CODEC_TYPE::encode(const page_type& page, disk_type& disk) {
+    if (encoded_size(page) > page_bytes) {
+        throw std::length_error("compressed leaf exceeds its page");
+    }
+    encode_to(page, page.size_, disk.data_);
+}
+
+COMPRESSED_LEAF_CODEC_TEMPLATE_ARGS
+void COMPRESSED_LEAF_CODEC_TYPE::decode(const disk_type& disk, page_type& page) {
+    size_t len = 0;
+    page.size_ = get_varint(disk.data_, len);
+    get_field(disk.data_, len, page.right_, diskpos_t(0));
+    KeyType prev_key;
+    ValueType prev_val;
+    std::memset(static_cast<void *>(&prev_key), 0, sizeof(KeyType));
+    std::memset(static_cast<void *>(&prev_val), 0, sizeof(ValueType));
+    for (size_t i = 0; i < page.size_; i++) {
+        KeyType key;
+        ValueType val;
+        get_field(disk.data_, len, key, prev_key);
+        get_field(disk.data_, len, val, prev_val);
+        page.set(static_cast<int>(i), KEYPAIR_TYPE(key, val));
+        prev_key = key;
+        prev_val = val;
+    }
+}
+
+} // namespace sjtu
+
+#endif // CODEC_HPP
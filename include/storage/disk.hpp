@@ -1,9 +1,11 @@
 #ifndef DISK_HPP
 #define DISK_HPP
 
+#include <cstdio>
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
 
 #include "../config.hpp"
 
@@ -20,12 +22,17 @@ private:
     constexpr static diskpos_t sizeofInfo = sizeof(FixedInfoType);
     constexpr static diskpos_t info_offset = info_len * sizeofInfo;
     constexpr static int free_index = 3;
+    constexpr static int format_index = info_len;
+    constexpr static diskpos_t format_tag = 0x3253414d4b534944;
 
     /*
         Current info area distribution:
 
-            [1. root of BPT] [2. size of free list] [3. free pos #1] ... [(n + 2). free pos #n]
+            [1. size of free list] [2. root of BPT] [3. free pos #1] ... [(n + 2). free pos #n] [info_len. format tag]
 
+        The header takes info_len whole info slots, records start right after it.
+        Files from before the tag wrote a shorter header and let records overlap
+        the last slots, so they are refused on open and have to be rebuilt.
     */
 
     bool open_file();
@@ -79,6 +86,7 @@ private:
                 cur = cur->next_;
                 delete del;
             }
+            head_->next_ = nullptr;
             size_ = 0;
         }
 
@@ -117,8 +125,16 @@ public:
 
     void erase(diskpos_t pos);
 
+    void flush();
+
     void clear();
 
+    bool replace(const std::string& source);
+
+    size_t record_count();
+
+    size_t free_count() const;
+
 };
 
 DISKMANAGER_TEMPLATE_ARGS
@@ -128,12 +144,21 @@ bool DISKMANAGER_TYPE::open_file() {
         file_.open(file_name_, std::ios::out | std::ios::binary);
         file_.close();
         file_.open(file_name_, std::ios::in | std::ios::out | std::ios::binary);
-        int temp = 0;
-        for (int i = 0; i < info_len; i++) {
-            file_.write(reinterpret_cast<char *>(&temp), sizeof(int));
+        FixedInfoType temp = FixedInfoType();
+        for (int i = 1; i < info_len; i++) {
+            file_.write(reinterpret_cast<char *>(&temp), sizeofInfo);
         }
+        temp = static_cast<FixedInfoType>(format_tag);
+        file_.write(reinterpret_cast<char *>(&temp), sizeofInfo);
         return false;
     }
+    FixedInfoType tag = FixedInfoType();
+    file_.seekg((format_index - 1) * sizeofInfo);
+    file_.read(reinterpret_cast<char *>(&tag), sizeofInfo);
+    if (!file_ || tag != static_cast<FixedInfoType>(format_tag)) {
+        file_.close();
+        throw std::runtime_error(file_name_ + " is not in the current storage format, rebuild the data");
+    }
     return true;
 }
 
@@ -141,7 +166,7 @@ DISKMANAGER_TEMPLATE_ARGS
 void DISKMANAGER_TYPE::flush_list() {
     diskpos_t size = static_cast<diskpos_t>(free_.size());
     write_info(size, 1);
-    constexpr int free_capacity = info_len - free_index + 1;
+    constexpr int free_capacity = info_len - free_index;
     if (free_capacity > 0 && static_cast<int>(free_.size()) <= free_capacity) {
         typename FreeList::FreeListNode *cur = free_.head_->next_;
         for (int i = 0; i < static_cast<int>(free_.size()); i++) {
@@ -163,7 +188,7 @@ DISKMANAGER_TEMPLATE_ARGS
 void DISKMANAGER_TYPE::restore_list() {
     diskpos_t size;
     get_info(size, 1);
-    constexpr int free_capacity = info_len - free_index + 1;
+    constexpr int free_capacity = info_len - free_index;
     if (free_capacity > 0 && static_cast<int>(size) <= free_capacity) {
         for (int i = free_index; i < static_cast<int>(size) + free_index; i++) {
             diskpos_t pos;
@@ -269,12 +294,52 @@ void DISKMANAGER_TYPE::erase(diskpos_t pos) {
     }
 }
 
+DISKMANAGER_TEMPLATE_ARGS
+void DISKMANAGER_TYPE::flush() {
+    if (reuse) {
+        flush_list();
+    }
+    file_.flush();
+}
+
 DISKMANAGER_TEMPLATE_ARGS
 void DISKMANAGER_TYPE::clear() {
     if (file_.is_open()) {
         file_.close();
     }
-    file_.open(file_name_, std::ios::binary | std::ios::trunc);
+    std::remove(file_name_.c_str());
+    free_.clear();
+    open_file();
+}
+
+/*
+    Swaps in the file source for this one by renaming it over the file.
+    Returns false, with the old file open again, if the rename fails.
+*/
+DISKMANAGER_TEMPLATE_ARGS
+bool DISKMANAGER_TYPE::replace(const std::string& source) {
+    if (file_.is_open()) {
+        file_.close();
+    }
+    bool renamed = std::rename(source.c_str(), file_name_.c_str()) == 0;
+    if (renamed) {
+        free_.clear();
+    }
+    open_file();
+    return renamed;
+}
+
+// number of records the file has room for, freed ones included
+DISKMANAGER_TEMPLATE_ARGS
+size_t DISKMANAGER_TYPE::record_count() {
+    file_.seekg(0, std::ios::end);
+    diskpos_t end = file_.tellg();
+    return end > info_offset ? static_cast<size_t>((end - info_offset) / sizeofT) : 0;
+}
+
+DISKMANAGER_TEMPLATE_ARGS
+size_t DISKMANAGER_TYPE::free_count() const {
+    return free_.size();
 }
 
 } // namespace sjtu
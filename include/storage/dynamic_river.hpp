@@ -6,8 +6,26 @@
 #include <string>
 
 #include "../config.hpp"
+#include "../stl/vector.hpp"
 
 namespace sjtu {
+
+/*
+    Records are kept in slots whose size is a multiple of RIVER_GRANULE,
+    the record padded with zeros. Erased slots go to the free list of
+    their size class, and a record of the same class takes one of those
+    before the file is extended. An update that changes the class of a
+    record moves it, so update returns where the record now lives.
+
+    The free lists are saved to <file>.free.dat:
+
+        [clean flag] [aligned from] [slot count] [pos, class]...
+
+    Records before "aligned from" were written without padding and fill
+    exactly their own length. As with the Bloom filter, the header is
+    marked dirty before the lists first change; dirty lists are dropped
+    on open, which only leaks their slots.
+*/
 template<typename T, typename Stringifier, typename AntiStringifier, typename SizeCalculator>
 class DynamicRiver {
 private:
@@ -16,6 +34,10 @@ private:
     Stringifier str_;
     AntiStringifier astr_;
     SizeCalculator calc_;
+    // free slot positions by size class, in granules
+    sjtu::vector<sjtu::vector<diskpos_t>> free_;
+    diskpos_t aligned_from_ = 0;
+    bool dirty_ = false;
 
     bool open_file() {
         file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
@@ -28,13 +50,107 @@ private:
         return 1;
     }
 
+    std::string free_file_name() const {
+        return file_name + ".free.dat";
+    }
+
+    diskpos_t file_size() {
+        file.seekg(0, std::ios::end);
+        return file.tellg();
+    }
+
+    static size_t size_class(int len) {
+        return (len + RIVER_GRANULE - 1) / RIVER_GRANULE;
+    }
+
+    void write_free_header(diskpos_t clean) {
+        std::fstream free_file(free_file_name(), std::ios::in | std::ios::out | std::ios::binary);
+        if (!free_file) {
+            free_file.open(free_file_name(), std::ios::out | std::ios::binary);
+        }
+        diskpos_t header[3] = {clean, aligned_from_, 0};
+        free_file.seekp(0);
+        free_file.write(reinterpret_cast<char *>(header), sizeof(header));
+    }
+
+    void mark_dirty() {
+        if (!dirty_) {
+            write_free_header(0);
+            dirty_ = true;
+        }
+    }
+
+    void load_free() {
+        free_.clear();
+        dirty_ = false;
+        std::ifstream free_file(free_file_name(), std::ios::binary);
+        diskpos_t header[3] = {0, 0, 0};
+        if (!free_file || !free_file.read(reinterpret_cast<char *>(header), sizeof(header))) {
+            // nothing written since before the slots were padded
+            aligned_from_ = file_size();
+            write_free_header(1);
+            return;
+        }
+        aligned_from_ = header[1];
+        if (header[0] != 1) {
+            return;
+        }
+        for (diskpos_t i = 0; i < header[2]; i++) {
+            diskpos_t slot[2];
+            if (!free_file.read(reinterpret_cast<char *>(slot), sizeof(slot))) {
+                free_.clear();
+                return;
+            }
+            push_free(slot[0], slot[1]);
+        }
+    }
+
+    void push_free(diskpos_t pos, size_t cls) {
+        while (free_.size() <= cls) {
+            free_.push_back(sjtu::vector<diskpos_t>());
+        }
+        free_[cls].push_back(pos);
+    }
+
+    // the bytes the slot at pos may hold, given the length of its record
+    size_t capacity(diskpos_t pos, int len) const {
+        return pos >= aligned_from_ ? size_class(len) * RIVER_GRANULE : len;
+    }
+
+    diskpos_t place(const char *data, int len) {
+        size_t cls = size_class(len);
+        if (cls < free_.size() && !free_[cls].empty()) {
+            mark_dirty();
+            diskpos_t pos = free_[cls].back();
+            free_[cls].pop_back();
+            file.seekp(pos);
+            file.write(data, len);
+            return pos;
+        }
+        file.seekp(0, std::ios::end);
+        diskpos_t pos = file.tellp();
+        file.write(data, len);
+        static const char zeros[RIVER_GRANULE] = {};
+        file.write(zeros, cls * RIVER_GRANULE - len);
+        return pos;
+    }
+
+    int record_length(diskpos_t pos) {
+        int siz = 0;
+        file.seekg(pos);
+        file.read(reinterpret_cast<char *>(&siz), 4);
+        return calc_(siz);
+    }
+
 public:
     DynamicRiver(const std::string& file_name) : file_name(file_name), str_(), astr_() {
         open_file();
+        load_free();
     }
 
     ~DynamicRiver() {
         if (file.is_open()) {
+            flush();
             file.close();
         }
     }
@@ -49,42 +165,87 @@ public:
         }
         file.close();
         file.open(file_name, std::ios::in | std::ios::out | std::ios::binary);
+        free_.clear();
+        aligned_from_ = 0;
+        dirty_ = false;
+        write_free_header(1);
     }
 
-    void flush() {}
+    void flush() {
+        file.flush();
+        if (!dirty_) {
+            return;
+        }
+        std::ofstream free_file(free_file_name(), std::ios::binary | std::ios::trunc);
+        diskpos_t count = 0;
+        for (size_t i = 0; i < free_.size(); i++) {
+            count += free_[i].size();
+        }
+        diskpos_t header[3] = {1, aligned_from_, count};
+        free_file.write(reinterpret_cast<char *>(header), sizeof(header));
+        for (size_t i = 0; i < free_.size(); i++) {
+            for (size_t j = 0; j < free_[i].size(); j++) {
+                diskpos_t slot[2] = {free_[i][j], static_cast<diskpos_t>(i)};
+                free_file.write(reinterpret_cast<char *>(slot), sizeof(slot));
+            }
+        }
+        dirty_ = false;
+    }
 
     diskpos_t write(T& t) {
         int len = 0;
         char *data = str_(t, len);
-        file.seekp(0, std::ios::end);
-        diskpos_t pos = file.tellp();
-        file.write(data, len);
+        diskpos_t pos = place(data, len);
         delete []data;
         return pos;
     }
 
-    void update(T& t, diskpos_t pos) {
+    // rewrites the record at pos in place if it keeps its size class, else moves it; returns its position
+    diskpos_t update(T& t, diskpos_t pos) {
         int len = 0;
         char *data = str_(t, len);
-        file.seekp(pos);
-        file.write(data, len);
+        size_t old_capacity = capacity(pos, record_length(pos));
+        if (size_class(len) * RIVER_GRANULE == old_capacity ||
+                (pos < aligned_from_ && static_cast<size_t>(len) == old_capacity)) {
+            file.seekp(pos);
+            file.write(data, len);
+        }
+        else {
+            erase(pos);
+            pos = place(data, len);
+        }
         delete []data;
+        return pos;
+    }
+
+    // frees the slot of the record at pos for later writes
+    void erase(diskpos_t pos) {
+        size_t cls = capacity(pos, record_length(pos)) / RIVER_GRANULE;
+        if (cls == 0) {
+            return;
+        }
+        mark_dirty();
+        push_free(pos, cls);
     }
 
     void read(T& t, diskpos_t pos) {
-        int siz = 0;
-        file.seekg(pos);
-        file.read(reinterpret_cast<char *>(&siz), 4);
-        int len = calc_(siz);
+        int len = 0;
+        char *data = read_bytes(pos, len);
+        t = astr_(data);
+        delete []data;
+    }
+
+    // the serialized object at pos, as written by the stringifier; the caller owns it
+    char *read_bytes(diskpos_t pos, int& len) {
+        len = record_length(pos);
         char *data = new char[len];
         file.seekg(pos);
         file.read(data, len);
-        t = astr_(data);
-        delete []data;
+        return data;
     }
 
 };
 
 } // namespace sjtu
 
-#endif // DYNAMIC_RIVER_HPP
\ No newline at end of file
+#endif // DYNAMIC_RIVER_HPP
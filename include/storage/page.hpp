@@ -2,17 +2,31 @@
 #define PAGE_HPP
 
 #include <iostream>
+#include <type_traits>
 
 #include "../config.hpp"
 #include "../utils/comparator.hpp"
 #include "../utils/type_helper.hpp"
+#include "search.hpp"
 
 namespace sjtu {
 #define KEYPAIR_TYPE KeyPair<KeyType, ValueType>
 #define KEYPAIR_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
 
-#define PAGE_TYPE Page<KeyType, ValueType>
-#define PAGE_TEMPLATE_ARGS template<typename KeyType, typename ValueType>
+#define LEAF_PAGE_TYPE LeafPage<KeyType, ValueType, slot_count>
+#define LEAF_PAGE_TEMPLATE_ARGS template<typename KeyType, typename ValueType, size_t slot_count>
+
+#define INTERNAL_PAGE_TYPE InternalPage<KeyType, ValueType, slot_count, tie_break>
+#define INTERNAL_PAGE_TEMPLATE_ARGS template<typename KeyType, typename ValueType, size_t slot_count, bool tie_break>
+
+// room reserved in every page for the link, the size and array padding
+constexpr size_t PAGE_HEADER_BYTES = 64;
+
+// even number of entries of entry_bytes each that fit in a page of page_bytes (two spare slots excluded)
+constexpr size_t page_slot_count(size_t page_bytes, size_t entry_bytes) {
+    size_t fit = page_bytes > PAGE_HEADER_BYTES ? (page_bytes - PAGE_HEADER_BYTES) / entry_bytes : 0;
+    return fit > 2 ? (fit - 2) / 2 * 2 : 0;
+}
 
 KEYPAIR_TEMPLATE_ARGS
 struct KeyPair {
@@ -114,93 +128,215 @@ bool operator<=(const KEYPAIR_TYPE& a, const KEYPAIR_TYPE& b) {
     return !(a > b);
 }
 
-enum class PageType {
-    Invalid = 0,
-    Leaf,
-    Internal
-};
-
-PAGE_TEMPLATE_ARGS
-struct Page {
-    KEYPAIR_TYPE data_[PAGE_SLOT_COUNT + 2];
-    diskpos_t ch_[PAGE_SLOT_COUNT + 2];
-    PageType type_ = PageType::Invalid;
-    diskpos_t fa_ = -1;
-    diskpos_t left_ = -1;
+/*
+    Leaf pages store keys and values in two parallel arrays, so a search only
+    walks over the keys and integral keys can use the vectorized kernel.
+    Keys with a normalized prefix (see FixedString::prefix) also keep it in
+    prefix_, so most comparisons are integer compares and the full key is
+    only compared among entries sharing the searched prefix.
+*/
+LEAF_PAGE_TEMPLATE_ARGS
+struct LeafPage {
+    constexpr static bool use_prefix = has_key_prefix_v<KeyType>;
+
+    uint64_t prefix_[use_prefix ? slot_count + 2 : 1];
+    KeyType keys_[slot_count + 2];
+    ValueType vals_[slot_count + 2];
     diskpos_t right_ = -1;
     size_t size_ = 0;
 
-    Page() = default;
+    LeafPage() = default;
+
+    LeafPage(const LeafPage&) = default;
 
-    Page(const Page&) = default;
+    ~LeafPage() = default;
 
-    ~Page() = default;
+    KEYPAIR_TYPE at(int idx) const;
+
+    void set(int idx, const KEYPAIR_TYPE& kp);
 
     int lower_bound(const KEYPAIR_TYPE& kp) const;
 
     int lower_bound(const KeyType& key) const;
 
+    int upper_bound(const KeyType& key) const;
+
     KEYPAIR_TYPE front() const;
 
     KEYPAIR_TYPE back() const;
 
 };
 
-PAGE_TEMPLATE_ARGS
-int PAGE_TYPE::lower_bound(const KEYPAIR_TYPE& kp) const {
-    if (size_ == 0) {
-        return 0;
+/*
+    Internal pages keep separators: (keys_[i], vals_[i]) is the last pair
+    of the subtree ch_[i] and sorts before every pair of ch_[i + 1], so a
+    page with size_ children holds size_ - 1 separators. Keys and values
+    are kept apart so routing by key only walks over the keys. With
+    tie_break the value breaks the tie when a run of equal keys spans
+    several children, and routing a pair then goes straight to the child
+    holding it. Trees of unique keys have no such runs, so their
+    separators are keys alone and vals_ is not stored.
+*/
+template<typename KeyType, typename ValueType, size_t slot_count, bool tie_break = true>
+struct InternalPage {
+    KeyType keys_[slot_count + 2];
+    std::conditional_t<tie_break, ValueType, char> vals_[tie_break ? slot_count + 2 : 1];
+    diskpos_t ch_[slot_count + 2];
+    size_t size_ = 0;
+
+    InternalPage() = default;
+
+    InternalPage(const InternalPage&) = default;
+
+    ~InternalPage() = default;
+
+    KEYPAIR_TYPE sep(int idx) const;
+
+    void set_sep(int idx, const KEYPAIR_TYPE& kp);
+
+    // first child that may hold key
+    int route(const KeyType& key) const;
+
+    // the child whose range holds kp
+    int route(const KEYPAIR_TYPE& kp) const;
+
+};
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE LEAF_PAGE_TYPE::at(int idx) const {
+    return KEYPAIR_TYPE(keys_[idx], vals_[idx]);
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+void LEAF_PAGE_TYPE::set(int idx, const KEYPAIR_TYPE& kp) {
+    if constexpr (use_prefix) {
+        prefix_[idx] = kp.key_.prefix();
     }
-    int l = 0, r = size_ - 1, mid = -1, ans = r;
-    while (l <= r) {
-        mid = (l + r) / 2;
-        if (data_[mid] < kp) {
+    keys_[idx] = kp.key_;
+    vals_[idx] = kp.val_;
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+int LEAF_PAGE_TYPE::lower_bound(const KEYPAIR_TYPE& kp) const {
+    int l = lower_bound(kp.key_);
+    int r = upper_bound(kp.key_);
+    // values only break ties inside the run of equal keys
+    while (l < r) {
+        int mid = (l + r) / 2;
+        bool less;
+        if constexpr (has_operator_less_v<ValueType>) {
+            less = vals_[mid] < kp.val_;
+        }
+        else {
+            Comparator<ValueType> val_comp;
+            less = val_comp(vals_[mid], kp.val_) < 0;
+        }
+        if (less) {
             l = mid + 1;
         }
         else {
-            ans = mid;
-            r = mid - 1;
+            r = mid;
         }
     }
-    return ans;
+    return l;
 }
 
-PAGE_TEMPLATE_ARGS
-int PAGE_TYPE::lower_bound(const KeyType& key) const {
-    if (size_ == 0) {
-        return 0;
+LEAF_PAGE_TEMPLATE_ARGS
+int LEAF_PAGE_TYPE::lower_bound(const KeyType& key) const {
+    if constexpr (use_prefix) {
+        uint64_t p = key.prefix();
+        int l = key_lower_bound(prefix_, static_cast<int>(size_), p);
+        int r = l + key_upper_bound(prefix_ + l, static_cast<int>(size_) - l, p);
+        return l + key_lower_bound(keys_ + l, r - l, key);
     }
-    int l = 0, r = size_ - 1, mid = -1, ans = r;
-    while (l <= r) {
-        mid = (l + r) / 2;
-        if (data_[mid].key_ < key) {
-            l = mid + 1;
-        }
-        else {
-            ans = mid;
-            r = mid - 1;
-        }
+    else {
+        return key_lower_bound(keys_, static_cast<int>(size_), key);
     }
-    return ans;
 }
 
-PAGE_TEMPLATE_ARGS
-KEYPAIR_TYPE PAGE_TYPE::front() const {
+LEAF_PAGE_TEMPLATE_ARGS
+int LEAF_PAGE_TYPE::upper_bound(const KeyType& key) const {
+    if constexpr (use_prefix) {
+        uint64_t p = key.prefix();
+        int l = key_lower_bound(prefix_, static_cast<int>(size_), p);
+        int r = l + key_upper_bound(prefix_ + l, static_cast<int>(size_) - l, p);
+        return l + key_upper_bound(keys_ + l, r - l, key);
+    }
+    else {
+        return key_upper_bound(keys_, static_cast<int>(size_), key);
+    }
+}
+
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE LEAF_PAGE_TYPE::front() const {
     if (!size_) {
         return KEYPAIR_TYPE();
     }
     else {
-        return data_[0];
+        return at(0);
     }
 }
 
-PAGE_TEMPLATE_ARGS
-KEYPAIR_TYPE PAGE_TYPE::back() const {
+LEAF_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE LEAF_PAGE_TYPE::back() const {
     if (!size_) {
         return KEYPAIR_TYPE();
     }
     else {
-        return data_[size_ - 1];
+        return at(size_ - 1);
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+KEYPAIR_TYPE INTERNAL_PAGE_TYPE::sep(int idx) const {
+    if constexpr (tie_break) {
+        return KEYPAIR_TYPE(keys_[idx], vals_[idx]);
+    }
+    else {
+        return KEYPAIR_TYPE(keys_[idx], ValueType());
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+void INTERNAL_PAGE_TYPE::set_sep(int idx, const KEYPAIR_TYPE& kp) {
+    keys_[idx] = kp.key_;
+    if constexpr (tie_break) {
+        vals_[idx] = kp.val_;
+    }
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+int INTERNAL_PAGE_TYPE::route(const KeyType& key) const {
+    return key_lower_bound(keys_, static_cast<int>(size_) - 1, key);
+}
+
+INTERNAL_PAGE_TEMPLATE_ARGS
+int INTERNAL_PAGE_TYPE::route(const KEYPAIR_TYPE& kp) const {
+    if constexpr (!tie_break) {
+        return route(kp.key_);
+    }
+    else {
+        int l = key_lower_bound(keys_, static_cast<int>(size_) - 1, kp.key_);
+        int r = key_upper_bound(keys_, static_cast<int>(size_) - 1, kp.key_);
+        // among separators of the same key, the first whose value is not below kp's
+        while (l < r) {
+            int mid = (l + r) / 2;
+            bool less;
+            if constexpr (has_operator_less_v<ValueType>) {
+                less = vals_[mid] < kp.val_;
+            }
+            else {
+                Comparator<ValueType> val_comp;
+                less = val_comp(vals_[mid], kp.val_) < 0;
+            }
+            if (less) {
+                l = mid + 1;
+            }
+            else {
+                r = mid;
+            }
+        }
+        return l;
     }
 }
 
@@ -0,0 +1,144 @@
+#ifndef SEARCH_HPP
+#define SEARCH_HPP
+
+#include <cstdint>
+#include <type_traits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "../utils/comparator.hpp"
+#include "../utils/type_helper.hpp"
+
+namespace sjtu {
+
+/*
+    In-page key search. Pages keep their keys in a separate array, so the
+    kernel is picked by key type at compile time: signed 32/64-bit keys are
+    counted with AVX2 when the build enables it, other integral keys use a
+    branchless binary search, and everything else falls back to the usual
+    comparison (operators if present, Comparator otherwise).
+*/
+
+template<typename KeyType>
+int compare_key(const KeyType& a, const KeyType& b) {
+    if constexpr (has_operator_less_v<KeyType> && has_operator_greater_v<KeyType>) {
+        if (a < b) return -1;
+        if (a > b) return 1;
+        return 0;
+    }
+    else {
+        Comparator<KeyType> key_comp;
+        return key_comp(a, b);
+    }
+}
+
+template<typename KeyType>
+constexpr bool is_simd_key_v = std::is_integral_v<KeyType> && std::is_signed_v<KeyType> &&
+    (sizeof(KeyType) == 4 || sizeof(KeyType) == 8);
+
+#ifdef __AVX2__
+// number of keys[i] < key (or keys[i] <= key if inclusive), keys sorted
+template<typename KeyType>
+int simd_count(const KeyType* keys, int n, KeyType key, bool inclusive) {
+    int i = 0;
+    int cnt = 0;
+    if constexpr (sizeof(KeyType) == 4) {
+        __m256i k = _mm256_set1_epi32(static_cast<int32_t>(key));
+        for (; i + 8 <= n; i += 8) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+            __m256i m = inclusive ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+            int bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+            cnt += inclusive ? 8 - bits : bits;
+        }
+    }
+    else {
+        __m256i k = _mm256_set1_epi64x(static_cast<int64_t>(key));
+        for (; i + 4 <= n; i += 4) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+            __m256i m = inclusive ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+            int bits = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+            cnt += inclusive ? 4 - bits : bits;
+        }
+    }
+    for (; i < n; i++) {
+        cnt += inclusive ? (keys[i] <= key) : (keys[i] < key);
+    }
+    return cnt;
+}
+#endif
+
+// first i in [0, n) with !(keys[i] < key), n if none
+template<typename KeyType>
+int key_lower_bound(const KeyType* keys, int n, const KeyType& key) {
+    if constexpr (std::is_integral_v<KeyType>) {
+#ifdef __AVX2__
+        if constexpr (is_simd_key_v<KeyType>) {
+            return simd_count(keys, n, key, false);
+        }
+#endif
+        if (n == 0) {
+            return 0;
+        }
+        const KeyType* base = keys;
+        while (n > 1) {
+            int half = n / 2;
+            base = (base[half - 1] < key) ? base + half : base;
+            n -= half;
+        }
+        return static_cast<int>(base - keys) + (*base < key);
+    }
+    else {
+        int l = 0, r = n;
+        while (l < r) {
+            int mid = (l + r) / 2;
+            if (compare_key(keys[mid], key) < 0) {
+                l = mid + 1;
+            }
+            else {
+                r = mid;
+            }
+        }
+        return l;
+    }
+}
+
+// first i in [0, n) with key < keys[i], n if none
+template<typename KeyType>
+int key_upper_bound(const KeyType* keys, int n, const KeyType& key) {
+    if constexpr (std::is_integral_v<KeyType>) {
+#ifdef __AVX2__
+        if constexpr (is_simd_key_v<KeyType>) {
+            return simd_count(keys, n, key, true);
+        }
+#endif
+        if (n == 0) {
+            return 0;
+        }
+        const KeyType* base = keys;
+        while (n > 1) {
+            int half = n / 2;
+            base = (base[half - 1] <= key) ? base + half : base;
+            n -= half;
+        }
+        return static_cast<int>(base - keys) + (*base <= key);
+    }
+    else {
+        int l = 0, r = n;
+        while (l < r) {
+            int mid = (l + r) / 2;
+            if (compare_key(keys[mid], key) <= 0) {
+                l = mid + 1;
+            }
+            else {
+                r = mid;
+            }
+        }
+        return l;
+    }
+}
+
+} // namespace sjtu
+
+#endif // SEARCH_HPP
@@ -0,0 +1,238 @@
+#ifndef SEPARATED_BPT_HPP
+#define SEPARATED_BPT_HPP
+
+#include <optional>
+#include <string>
+#include <type_traits>
+
+#include "../config.hpp"
+#include "bpt.hpp"
+#include "disk.hpp"
+#include "../stl/vector.hpp"
+
+namespace sjtu {
+#define SEPARATED_BPT_TYPE SeparatedBPlusTree<KeyType, ValueType, IndexType, Indexer, page_bytes, compressed>
+#define SEPARATED_BPT_TEMPLATE_ARGS template<typename KeyType, typename ValueType, typename IndexType, typename Indexer, size_t page_bytes, bool compressed>
+
+/*
+    Index of a value that takes part in the tree order. Trees with unique keys
+    do not need one, so NullIndex makes every value of a key compare equal,
+    and their index tree is a unique one with key-only separators.
+*/
+struct NullIndex {};
+
+inline bool operator==(const NullIndex&, const NullIndex&) {
+    return true;
+}
+
+inline bool operator!=(const NullIndex&, const NullIndex&) {
+    return false;
+}
+
+inline bool operator<(const NullIndex&, const NullIndex&) {
+    return false;
+}
+
+inline bool operator>(const NullIndex&, const NullIndex&) {
+    return false;
+}
+
+struct NullIndexer {
+    template<typename T>
+    NullIndex operator()(const T&) const {
+        return NullIndex();
+    }
+};
+
+template<typename IndexType>
+struct RecordRef {
+    IndexType index_;
+    diskpos_t pos_;
+};
+
+template<typename IndexType>
+bool operator==(const RecordRef<IndexType>& a, const RecordRef<IndexType>& b) {
+    return a.index_ == b.index_;
+}
+
+template<typename IndexType>
+bool operator!=(const RecordRef<IndexType>& a, const RecordRef<IndexType>& b) {
+    return !(a.index_ == b.index_);
+}
+
+template<typename IndexType>
+bool operator<(const RecordRef<IndexType>& a, const RecordRef<IndexType>& b) {
+    return a.index_ < b.index_;
+}
+
+template<typename IndexType>
+bool operator>(const RecordRef<IndexType>& a, const RecordRef<IndexType>& b) {
+    return b.index_ < a.index_;
+}
+
+/*
+    B+ tree with key-value separation: the leaves only hold the key and a
+    RecordRef, while the values live in a record heap next to the index file.
+    Indexer projects a value onto the part of it that orders values of the
+    same key, so the index stays small even when ValueType is large.
+    compressed and filtered are passed on to the index tree.
+*/
+template<typename KeyType, typename ValueType, typename IndexType = NullIndex, typename Indexer = NullIndexer,
+    size_t page_bytes = PAGE_BYTES, bool compressed = false>
+class SeparatedBPlusTree {
+private:
+    BPlusTree<KeyType, RecordRef<IndexType>, page_bytes, compressed, std::is_same_v<IndexType, NullIndex>> index_;
+    DiskManager<ValueType, diskpos_t, 12, true> heap_;
+    Indexer indexer_;
+
+public:
+    SeparatedBPlusTree(const std::string file_name = "separated_bpt.dat", bool filtered = false);
+
+    ~SeparatedBPlusTree() = default;
+
+    bool empty() const;
+
+    std::optional<ValueType> find(const KeyType& key);
+
+    void find_all(const KeyType& key, sjtu::vector<ValueType>& vec);
+
+    bool insert(const KeyType& key, const ValueType& val);
+
+    void erase(const KeyType& key, const ValueType& val);
+
+    template<typename Mutator>
+    bool update(const KeyType& key, const ValueType& val, Mutator mutator);
+
+    bool upsert(const KeyType& key, const ValueType& val);
+
+    void serialize(sjtu::vector<ValueType>& vec);
+
+    void flush();
+
+    void clear();
+
+    bool compact(double fill = COMPACT_FILL);
+
+};
+
+SEPARATED_BPT_TEMPLATE_ARGS
+SEPARATED_BPT_TYPE::SeparatedBPlusTree(const std::string file_name, bool filtered) : index_(file_name, filtered) {
+    heap_.initialise(file_name + ".heap.dat");
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+bool SEPARATED_BPT_TYPE::empty() const {
+    return index_.empty();
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+std::optional<ValueType> SEPARATED_BPT_TYPE::find(const KeyType& key) {
+    auto ref = index_.find(key);
+    if (!ref.has_value()) {
+        return std::nullopt;
+    }
+    ValueType val;
+    heap_.read(val, ref->pos_);
+    return val;
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+void SEPARATED_BPT_TYPE::find_all(const KeyType& key, sjtu::vector<ValueType>& vec) {
+    vec.clear();
+    sjtu::vector<RecordRef<IndexType>> refs;
+    index_.find_all(key, refs);
+    for (size_t i = 0; i < refs.size(); i++) {
+        ValueType val;
+        heap_.read(val, refs[i].pos_);
+        vec.push_back(val);
+    }
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+bool SEPARATED_BPT_TYPE::insert(const KeyType& key, const ValueType& val) {
+    ValueType record = val;
+    RecordRef<IndexType> ref{indexer_(val), heap_.write(record)};
+    if (!index_.insert(key, ref)) {
+        heap_.erase(ref.pos_);
+        return false;
+    }
+    return true;
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+void SEPARATED_BPT_TYPE::erase(const KeyType& key, const ValueType& val) {
+    auto ref = index_.find(key, RecordRef<IndexType>{indexer_(val), -1});
+    if (!ref.has_value()) {
+        return;
+    }
+    index_.erase(key, ref.value());
+    heap_.erase(ref->pos_);
+}
+
+/*
+    The record is rewritten in place in the heap. The index is only touched
+    when the mutation changes the record's IndexType.
+*/
+SEPARATED_BPT_TEMPLATE_ARGS
+template<typename Mutator>
+bool SEPARATED_BPT_TYPE::update(const KeyType& key, const ValueType& val, Mutator mutator) {
+    auto ref = index_.find(key, RecordRef<IndexType>{indexer_(val), -1});
+    if (!ref.has_value()) {
+        return false;
+    }
+    ValueType record;
+    heap_.read(record, ref->pos_);
+    mutator(record);
+    RecordRef<IndexType> new_ref{indexer_(record), ref->pos_};
+    if (new_ref != ref.value()) {
+        if (index_.find(key, new_ref).has_value()) {
+            return false;
+        }
+        index_.erase(key, ref.value());
+        index_.insert(key, new_ref);
+    }
+    heap_.update(record, ref->pos_);
+    return true;
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+bool SEPARATED_BPT_TYPE::upsert(const KeyType& key, const ValueType& val) {
+    if (update(key, val, [&val](ValueType& stored) { stored = val; })) {
+        return false;
+    }
+    return insert(key, val);
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+void SEPARATED_BPT_TYPE::serialize(sjtu::vector<ValueType>& vec) {
+    vec.clear();
+    sjtu::vector<RecordRef<IndexType>> refs;
+    index_.serialize(refs);
+    for (size_t i = 0; i < refs.size(); i++) {
+        ValueType val;
+        heap_.read(val, refs[i].pos_);
+        vec.push_back(val);
+    }
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+void SEPARATED_BPT_TYPE::flush() {
+    index_.flush();
+    heap_.flush();
+}
+
+SEPARATED_BPT_TEMPLATE_ARGS
+void SEPARATED_BPT_TYPE::clear() {
+    index_.clear();
+    heap_.clear();
+}
+
+// freed heap records are already reused, so only the index is rewritten
+SEPARATED_BPT_TEMPLATE_ARGS
+bool SEPARATED_BPT_TYPE::compact(double fill) {
+    return index_.compact(fill);
+}
+
+} // namespace sjtu
+
+#endif // SEPARATED_BPT_HPP
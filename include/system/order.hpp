@@ -4,6 +4,7 @@
 #include "../../include/utils/time_date.hpp"
 #include "../../include/utils/fixed_string.hpp"
 #include "../../include/storage/bpt.hpp"
+#include "../../include/storage/separated_bpt.hpp"
 #include "../../include/stl/vector.hpp"
 
 namespace sjtu {
@@ -71,7 +72,8 @@ enum class TicketStatus {
     Invalid = 0,
     Purchased,
     Pending,
-    Refunded
+    Refunded,
+    Expired
 };
 
 struct OrderInfo {
@@ -147,18 +149,36 @@ struct OrderTimeReverseCompare {
     }
 };
 
+struct OrderTimestampIndexer {
+    int operator()(const Order& o) const {
+        return o.info_.purchase_timestamp_;
+    }
+};
+
+// first half of a transfer; its arrival is in minutes since the first day of the train's sale year
+struct TransferLeg {
+    Ticket ticket_;
+    int arrival_minutes_;
+};
+
+struct TransferLegEndStationCompare {
+    bool operator()(const TransferLeg& a, const TransferLeg& b) const {
+        return TicketEndStationCompare()(a.ticket_, b.ticket_);
+    }
+};
+
 struct TransferTicket {
     Ticket first_ticket_;
     Ticket second_ticket_;
+    // minutes from the first departure to the last arrival; the dates wrap at new year, so it is kept here
+    int duration_;
 
     int price() const {
         return first_ticket_.price_ + second_ticket_.price_;
     }
 
     int duration() const {
-        int arrival = int(second_ticket_.arrival_date_) * 1440 + second_ticket_.arrival_time_.hr_ * 60 + second_ticket_.arrival_time_.min_;
-        int departure = int(first_ticket_.departure_date_) * 1440 + first_ticket_.departure_time_.hr_ * 60 +first_ticket_.departure_time_.min_;
-        return arrival - departure;
+        return duration_;
     }
 
 };
@@ -204,9 +224,11 @@ struct TransferTicketDurationCompare {
 
 class OrderSystem {
 private:
-    BPlusTree<FixedString<20>, Order> user_order_map_;
+    // index keys repeat per user and timestamps grow, so its leaves compress well
+    SeparatedBPlusTree<FixedString<20>, Order, int, OrderTimestampIndexer, PAGE_BYTES, true> user_order_map_;
     // BPlusTree<OrderInfo, Order> order_map_;
-    BPlusTree<int, Order> queue_map_;
+    // orders are large, so the queue gets bigger leaves; timestamps are unique, so separators hold them alone
+    BPlusTree<int, Order, 16384, false, true> queue_map_;
 
 public:
     OrderSystem(const std::string& name = "order") :
@@ -216,22 +238,78 @@ public:
 
     void delete_order(const Order& order);
 
+    void update_order_status(const Order& order, TicketStatus status);
+
     void query_order(const std::string& username, sjtu::vector<Order>& orders);
 
     // void query_order(const OrderInfo& info, sjtu::vector<Order>& orders);
 
-    void get_pending_queue(sjtu::vector<Order>& pending_orders);
+    // calls visit on each pending order by purchase time, as the queue was when the walk began
+    template<typename Visitor>
+    void walk_pending_queue(Visitor visit);
 
     void add_pending_order(const Order& order);
 
     void remove_pending_order(int pending_id);
 
+    // marks the pending orders that stale says have left as expired and drops them from the queue
+    template<typename StaleCheck>
+    int expire_pending_orders(StaleCheck stale);
+
     void flush();
 
     void clear();
 
+    bool compact();
+
 };
 
+/*
+    The walk reads a snapshot of the queue one leaf at a time instead of
+    copying the whole queue out, and visit may remove pending orders or add
+    new ones meanwhile without the walk skipping or repeating an order.
+*/
+template<typename Visitor>
+void OrderSystem::walk_pending_queue(Visitor visit) {
+    TreeSnapshot snap = queue_map_.snapshot();
+    queue_map_.for_each(snap, [&visit](const int&, const Order& order) {
+        visit(order);
+    });
+    queue_map_.release(snap);
+}
+
+/*
+    The queue is keyed by timestamp, so each run of stale orders leaves with
+    one range erase. The walk reads a snapshot one leaf at a time, so a run
+    is erased as soon as it ends without disturbing the rest of the walk.
+*/
+template<typename StaleCheck>
+int OrderSystem::expire_pending_orders(StaleCheck stale) {
+    int expired = 0;
+    bool in_run = false;
+    int run_first = 0, run_last = 0;
+    walk_pending_queue([&](const Order& order) {
+        if (!stale(order)) {
+            if (in_run) {
+                queue_map_.erase_range(run_first, run_last);
+                in_run = false;
+            }
+            return;
+        }
+        update_order_status(order, TicketStatus::Expired);
+        if (!in_run) {
+            run_first = order.info_.purchase_timestamp_;
+            in_run = true;
+        }
+        run_last = order.info_.purchase_timestamp_;
+        expired++;
+    });
+    if (in_run) {
+        queue_map_.erase_range(run_first, run_last);
+    }
+    return expired;
+}
+
 } // namespace sjtu
 
 #endif // ORDER_HPP
\ No newline at end of file
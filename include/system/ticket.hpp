@@ -87,8 +87,13 @@ public:
 
     void refund_ticket(bool pack = false, Result **res = nullptr);
 
+    void expire(bool pack = false, Result **res = nullptr);
+
     void clear();
 
+    // false if some tree could not switch to its rewritten files and kept the old ones
+    bool compact();
+
 };
 
 } // namespace sjtu
@@ -1,16 +1,22 @@
 #ifndef TRAIN_HPP
 #define TRAIN_HPP
 
+#include <memory>
+
 #include "../../include/utils/fixed_string.hpp"
 #include "../../include/utils/time_date.hpp"
 #include "../../include/storage/bpt.hpp"
+#include "../../include/storage/codec.hpp"
 #include "../../include/storage/dynamic_river.hpp"
 #include "../../include/storage/memory_river.hpp"
+#include "../../include/stl/lru_cache.hpp"
 #include "../../include/stl/vector.hpp"
 
 namespace sjtu {
 
 constexpr int max_stations = 100;
+// serialized trains kept in memory by TrainSystem, at most 2.8 KiB each
+constexpr int train_cache_size = 1024;
 
 struct Train {
     int stationNum_;
@@ -18,21 +24,121 @@ struct Train {
     int stations_[max_stations];
     int seatNum_;
     int prices_[max_stations];
-    time startTime_;
+    // minutes after midnight
+    int startTime_;
     int travelTimes_[max_stations];
     int stopoverTimes_[max_stations];
-    time arrivalTimes_[max_stations];
-    int seats_[92][max_stations];
     date startSaleDate_;
     date endSaleDate_;
     char type_;
     bool released_;
+    // row of the first sale day in the seat inventory
+    int seat_base_;
+    // derived by TrainSystem::add_train: fare from the first station to
+    // station i, and minutes from midnight of the departure day to the
+    // arrival at and the departure from station i
+    int priceSums_[max_stations];
+    int arrivalMinutes_[max_stations];
+    int leavingMinutes_[max_stations];
 };
 
-struct TrainStringifier {
+// seats left on each segment of a train on one day
+struct SeatRow {
+    int seats_[max_stations];
+};
+
+/*
+    Segment tree over the first n segments of a seat row, with range
+    minimum and range add in O(log n). The refund path builds one for the
+    day it frees seats on and checks every waiting order of that train
+    against it, instead of scanning the row once per order; store writes
+    the counts back. A node's minimum already includes its own pending
+    add, which is never pushed down: queries sum the adds on their path.
+*/
+class SeatIndex {
+private:
+    int n_;
+    int min_[4 * max_stations];
+    int add_[4 * max_stations];
+
+    void build(int node, int l, int r, const SeatRow& seats);
+
+    int min(int node, int l, int r, int from, int to) const;
+
+    void add(int node, int l, int r, int from, int to, int val);
+
+    void store(int node, int l, int r, int acc, SeatRow& seats) const;
+
+public:
+    SeatIndex(const SeatRow& seats, int n);
+
+    // fewest seats left on segments [from, to)
+    int min(int from, int to) const;
+
+    void add(int from, int to, int val);
+
+    void store(SeatRow& seats) const;
+
+};
+
+/*
+    Seat counts kept apart from the trains, one fixed-size row per train
+    and day, so selling a ticket rewrites a single row and leaves the train
+    record alone. The rows of a train are allocated together when it is
+    released, so a train deleted before its release never takes any; the
+    one of a day sits at its seat_base_ plus the day's offset from the
+    first sale date.
+*/
+class SeatInventory {
+private:
+    MemoryRiver<SeatRow> rows_;
+
+public:
+    SeatInventory(const std::string& file_name) : rows_(file_name) {}
+
+    int allocate(int days, int seat_num);
+
+    void read(int row, SeatRow& seats);
+
+    void write(int row, SeatRow& seats);
+
+    void flush();
+
+    void clear();
+
+};
+
+/*
+    Trains are written in a compact format:
+
+        [header] [stationNum] [trainID] [seatNum] [startTime]
+        [startSaleDate] [endSaleDate] [type] [released] [seat_base]
+        [station #1] ... [station #n]
+        [price #1] [travel #1] ... [price #n-1] [travel #n-1]
+        [stopover #2] ... [stopover #n-1]
+
+    The header holds train_format_compact in its top byte and the record
+    length in the rest. Integers are varints, the ID keeps only its used
+    bytes and a date is a month byte and a day byte. The schedule is kept
+    as the travel and stopover minutes between stations; the prefix fares
+    and absolute minutes are rebuilt when the record is decoded. The
+    release sets released and seat_base, which may lengthen the record;
+    DynamicRiver rewrites it in place while it keeps its size class.
+
+    Files from before the compact format hold records in the fixed layout
+    of TrainFixedStringifier or in the original 60 + 396n layout, which
+    kept 92 days of seats in the record. Both start with the bare station
+    count and cannot be told apart, so TrainSystem refuses a train file
+    whose first record lacks the header on open; such data has to be
+    rebuilt. The fixed layout is still decoded, as TrainView reads it.
+*/
+constexpr int train_format_compact = 2;
+
+// the fixed layout, 56 + 28n bytes, that TrainView reads; records written just before the compact format use it too
+struct TrainFixedStringifier {
     char *operator()(Train& t, int& len) const {
-        len = 60 + t.stationNum_ * 396;
-        char *data = new char[60 + t.stationNum_ * 396];
+        len = 56 + t.stationNum_ * 28;
+        char *data = new char[56 + t.stationNum_ * 28];
         memcpy(data, reinterpret_cast<char *>(&(t.stationNum_)), 4);
         for (int i = 0; i < 20; i++) {
             data[i + 4] = t.trainID_[i];
@@ -40,23 +146,90 @@ struct TrainStringifier {
         memcpy(data + 24, reinterpret_cast<char *>(t.stations_), t.stationNum_ * 4);
         memcpy(data + 24 + 4 * t.stationNum_, reinterpret_cast<char *>(&(t.seatNum_)), 4);
         memcpy(data + 28 + 4 * t.stationNum_, reinterpret_cast<char *>(t.prices_), t.stationNum_ * 4);
-        memcpy(data + 28 + 8 * t.stationNum_, reinterpret_cast<char *>(&(t.startTime_)), 12);
-        memcpy(data + 40 + 8 * t.stationNum_, reinterpret_cast<char *>(t.travelTimes_), t.stationNum_ * 4);
-        memcpy(data + 40 + 12 * t.stationNum_, reinterpret_cast<char *>(t.stopoverTimes_), t.stationNum_ * 4);
-        memcpy(data + 40 + 16 * t.stationNum_, reinterpret_cast<char *>(t.arrivalTimes_), t.stationNum_ * 12);
-        for (int i = 0; i < 92; i++) {
-            memcpy(data + 40 + (28 + i * 4) * t.stationNum_, reinterpret_cast<char *>(t.seats_[i]), t.stationNum_ * 4);
-        }
-        memcpy(data + 40 + 396 * t.stationNum_, reinterpret_cast<char *>(&(t.startSaleDate_)), 8);
-        memcpy(data + 48 + 396 * t.stationNum_, reinterpret_cast<char *>(&(t.endSaleDate_)), 8);
-        data[56 + 396 * t.stationNum_] = t.type_;
-        data[57 + 396 * t.stationNum_] = t.released_;
+        memcpy(data + 28 + 8 * t.stationNum_, reinterpret_cast<char *>(&(t.startTime_)), 4);
+        memcpy(data + 32 + 8 * t.stationNum_, reinterpret_cast<char *>(t.travelTimes_), t.stationNum_ * 4);
+        memcpy(data + 32 + 12 * t.stationNum_, reinterpret_cast<char *>(t.stopoverTimes_), t.stationNum_ * 4);
+        memcpy(data + 32 + 16 * t.stationNum_, reinterpret_cast<char *>(&(t.startSaleDate_)), 8);
+        memcpy(data + 40 + 16 * t.stationNum_, reinterpret_cast<char *>(&(t.endSaleDate_)), 8);
+        data[48 + 16 * t.stationNum_] = t.type_;
+        data[49 + 16 * t.stationNum_] = t.released_;
+        memcpy(data + 50 + 16 * t.stationNum_, reinterpret_cast<char *>(&(t.seat_base_)), 4);
+        memset(data + 54 + 16 * t.stationNum_, 0, 2);
+        memcpy(data + 56 + 16 * t.stationNum_, reinterpret_cast<char *>(t.priceSums_), t.stationNum_ * 4);
+        memcpy(data + 56 + 20 * t.stationNum_, reinterpret_cast<char *>(t.arrivalMinutes_), t.stationNum_ * 4);
+        memcpy(data + 56 + 24 * t.stationNum_, reinterpret_cast<char *>(t.leavingMinutes_), t.stationNum_ * 4);
         return data;
     }
 };
 
+struct TrainStringifier {
+    char *operator()(Train& t, int& len) const {
+        size_t size = encode(t, nullptr);
+        unsigned char *data = new unsigned char[size];
+        encode(t, data);
+        len = static_cast<int>(size);
+        return reinterpret_cast<char *>(data);
+    }
+
+private:
+    // the encoded size; writes the record too unless out is nullptr
+    static size_t encode(const Train& t, unsigned char *out) {
+        size_t len = 4;
+        int n = t.stationNum_;
+        put_varint(out, len, n);
+        size_t id_len = 0;
+        while (id_len < 20 && t.trainID_[id_len] != '\0') {
+            id_len++;
+        }
+        put_varint(out, len, id_len);
+        for (size_t i = 0; i < id_len; i++) {
+            if (out) {
+                out[len] = t.trainID_[i];
+            }
+            len++;
+        }
+        put_varint(out, len, t.seatNum_);
+        put_varint(out, len, t.startTime_);
+        unsigned char fixed[6] = {
+            static_cast<unsigned char>(t.startSaleDate_.month_), static_cast<unsigned char>(t.startSaleDate_.day_),
+            static_cast<unsigned char>(t.endSaleDate_.month_), static_cast<unsigned char>(t.endSaleDate_.day_),
+            static_cast<unsigned char>(t.type_), static_cast<unsigned char>(t.released_)
+        };
+        if (out) {
+            memcpy(out + len, fixed, 6);
+        }
+        len += 6;
+        put_varint(out, len, static_cast<uint32_t>(t.seat_base_));
+        for (int i = 0; i < n; i++) {
+            put_varint(out, len, static_cast<uint32_t>(t.stations_[i]));
+        }
+        for (int i = 0; i + 1 < n; i++) {
+            put_varint(out, len, t.prices_[i]);
+            put_varint(out, len, t.travelTimes_[i]);
+        }
+        for (int i = 1; i + 1 < n; i++) {
+            put_varint(out, len, t.stopoverTimes_[i]);
+        }
+        if (out) {
+            uint32_t header = static_cast<uint32_t>(train_format_compact) << 24 | static_cast<uint32_t>(len);
+            memcpy(out, &header, 4);
+        }
+        return len;
+    }
+};
+
 struct TrainAntiStringifier {
     Train operator()(const char *data) const {
+        uint32_t header;
+        memcpy(&header, data, 4);
+        if (header >> 24 == train_format_compact) {
+            return decode_compact(reinterpret_cast<const unsigned char *>(data));
+        }
+        return decode_fixed(data);
+    }
+
+private:
+    static Train decode_fixed(const char *data) {
         Train t;
         memcpy(reinterpret_cast<char *>(&(t.stationNum_)), data, 4);
         for (int i = 0; i < 20; i++) {
@@ -66,30 +239,209 @@ struct TrainAntiStringifier {
         memset(t.prices_, 0, sizeof(t.prices_));
         memset(t.travelTimes_, 0, sizeof(t.travelTimes_));
         memset(t.stopoverTimes_, 0, sizeof(t.stopoverTimes_));
-        memset(t.arrivalTimes_, 0, sizeof(t.arrivalTimes_));
-        memset(t.seats_, 0, sizeof(t.seats_));
+        memset(t.priceSums_, 0, sizeof(t.priceSums_));
+        memset(t.arrivalMinutes_, 0, sizeof(t.arrivalMinutes_));
+        memset(t.leavingMinutes_, 0, sizeof(t.leavingMinutes_));
         memcpy(reinterpret_cast<char *>(t.stations_), data + 24, t.stationNum_ * 4);
         memcpy(reinterpret_cast<char *>(&(t.seatNum_)), data + 24 + 4 * t.stationNum_, 4);
         memcpy(reinterpret_cast<char *>(t.prices_), data + 28 + 4 * t.stationNum_, t.stationNum_ * 4);
-        memcpy(reinterpret_cast<char *>(&(t.startTime_)), data + 28 + 8 * t.stationNum_, 12);
-        memcpy(reinterpret_cast<char *>(t.travelTimes_), data + 40 + 8 * t.stationNum_, t.stationNum_ * 4);
-        memcpy(reinterpret_cast<char *>(t.stopoverTimes_), data + 40 + 12 * t.stationNum_, t.stationNum_ * 4);
-        memcpy(reinterpret_cast<char *>(t.arrivalTimes_), data + 40 + 16 * t.stationNum_, t.stationNum_ * 12);
-        for (int i = 0; i < 92; i++) {
-            memcpy(reinterpret_cast<char *>(t.seats_[i]), data + 40 + (28 + i * 4) * t.stationNum_, t.stationNum_ * 4);
-        }
-        memcpy(reinterpret_cast<char *>(&(t.startSaleDate_)), data + 40 + 396 * t.stationNum_, 8);
-        memcpy(reinterpret_cast<char *>(&(t.endSaleDate_)), data + 48 + 396 * t.stationNum_, 8);
-        t.type_ = data[56 + 396 * t.stationNum_];
-        t.released_ = data[57 + 396 * t.stationNum_] != 0;
+        memcpy(reinterpret_cast<char *>(&(t.startTime_)), data + 28 + 8 * t.stationNum_, 4);
+        memcpy(reinterpret_cast<char *>(t.travelTimes_), data + 32 + 8 * t.stationNum_, t.stationNum_ * 4);
+        memcpy(reinterpret_cast<char *>(t.stopoverTimes_), data + 32 + 12 * t.stationNum_, t.stationNum_ * 4);
+        memcpy(reinterpret_cast<char *>(&(t.startSaleDate_)), data + 32 + 16 * t.stationNum_, 8);
+        memcpy(reinterpret_cast<char *>(&(t.endSaleDate_)), data + 40 + 16 * t.stationNum_, 8);
+        t.type_ = data[48 + 16 * t.stationNum_];
+        t.released_ = data[49 + 16 * t.stationNum_] != 0;
+        memcpy(reinterpret_cast<char *>(&(t.seat_base_)), data + 50 + 16 * t.stationNum_, 4);
+        memcpy(reinterpret_cast<char *>(t.priceSums_), data + 56 + 16 * t.stationNum_, t.stationNum_ * 4);
+        memcpy(reinterpret_cast<char *>(t.arrivalMinutes_), data + 56 + 20 * t.stationNum_, t.stationNum_ * 4);
+        memcpy(reinterpret_cast<char *>(t.leavingMinutes_), data + 56 + 24 * t.stationNum_, t.stationNum_ * 4);
+        return t;
+    }
+
+    static Train decode_compact(const unsigned char *in) {
+        Train t{};
+        size_t len = 4;
+        int n = static_cast<int>(get_varint(in, len));
+        t.stationNum_ = n;
+        size_t id_len = get_varint(in, len);
+        for (size_t i = 0; i < id_len; i++) {
+            t.trainID_[i] = static_cast<char>(in[len++]);
+        }
+        t.seatNum_ = static_cast<int>(get_varint(in, len));
+        t.startTime_ = static_cast<int>(get_varint(in, len));
+        t.startSaleDate_ = date(in[len], in[len + 1]);
+        t.endSaleDate_ = date(in[len + 2], in[len + 3]);
+        t.type_ = static_cast<char>(in[len + 4]);
+        t.released_ = in[len + 5] != 0;
+        len += 6;
+        t.seat_base_ = static_cast<int>(get_varint(in, len));
+        for (int i = 0; i < n; i++) {
+            t.stations_[i] = static_cast<int>(get_varint(in, len));
+        }
+        for (int i = 0; i + 1 < n; i++) {
+            t.prices_[i] = static_cast<int>(get_varint(in, len));
+            t.travelTimes_[i] = static_cast<int>(get_varint(in, len));
+        }
+        for (int i = 1; i + 1 < n; i++) {
+            t.stopoverTimes_[i] = static_cast<int>(get_varint(in, len));
+        }
+        for (int i = 0; i < n; i++) {
+            t.priceSums_[i] = i ? t.priceSums_[i - 1] + t.prices_[i - 1] : 0;
+            t.arrivalMinutes_[i] = i ? t.leavingMinutes_[i - 1] + t.travelTimes_[i - 1] : t.startTime_;
+            t.leavingMinutes_[i] = t.arrivalMinutes_[i] + t.stopoverTimes_[i];
+        }
         return t;
     }
 };
 
+// turns a compact record into the fixed layout directly, without building the whole Train
+struct TrainFixedExpander {
+    char *operator()(const char *data, int& len) const {
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(data);
+        size_t pos = 4;
+        int n = static_cast<int>(get_varint(in, pos));
+        len = 56 + n * 28;
+        char *out = new char[56 + n * 28];
+        memset(out, 0, len);
+        put<int>(out, 0, n);
+        size_t id_len = get_varint(in, pos);
+        memcpy(out + 4, in + pos, id_len);
+        pos += id_len;
+        put<int>(out, 24 + 4 * n, static_cast<int>(get_varint(in, pos)));
+        int start_time = static_cast<int>(get_varint(in, pos));
+        put<int>(out, 28 + 8 * n, start_time);
+        put<date>(out, 32 + 16 * n, date(in[pos], in[pos + 1]));
+        put<date>(out, 40 + 16 * n, date(in[pos + 2], in[pos + 3]));
+        out[48 + 16 * n] = static_cast<char>(in[pos + 4]);
+        out[49 + 16 * n] = in[pos + 5] != 0;
+        pos += 6;
+        put<int>(out, 50 + 16 * n, static_cast<int>(get_varint(in, pos)));
+        for (int i = 0; i < n; i++) {
+            put<int>(out, 24 + 4 * i, static_cast<int>(get_varint(in, pos)));
+        }
+        for (int i = 0; i + 1 < n; i++) {
+            put<int>(out, 28 + 4 * n + 4 * i, static_cast<int>(get_varint(in, pos)));
+            put<int>(out, 32 + 8 * n + 4 * i, static_cast<int>(get_varint(in, pos)));
+        }
+        for (int i = 1; i + 1 < n; i++) {
+            put<int>(out, 32 + 12 * n + 4 * i, static_cast<int>(get_varint(in, pos)));
+        }
+        int price_sum = 0;
+        int minutes = start_time;
+        for (int i = 0; i < n; i++) {
+            put<int>(out, 56 + 16 * n + 4 * i, price_sum);
+            put<int>(out, 56 + 20 * n + 4 * i, minutes);
+            minutes += get<int>(out, 32 + 12 * n + 4 * i);
+            put<int>(out, 56 + 24 * n + 4 * i, minutes);
+            price_sum += get<int>(out, 28 + 4 * n + 4 * i);
+            minutes += get<int>(out, 32 + 8 * n + 4 * i);
+        }
+        return out;
+    }
+
+private:
+    template<typename T>
+    static void put(char *out, int offset, const T& val) {
+        memcpy(out + offset, reinterpret_cast<const char *>(&val), sizeof(T));
+    }
+
+    template<typename T>
+    static T get(const char *out, int offset) {
+        T val;
+        memcpy(reinterpret_cast<char *>(&val), out + offset, sizeof(T));
+        return val;
+    }
+};
+
 struct TrainSizeCalculator {
+    // size is the first four bytes of a record
     int operator()(int size) const {
-        return 60 + size * 396;
+        uint32_t header = static_cast<uint32_t>(size);
+        if (header >> 24 == train_format_compact) {
+            return static_cast<int>(header & 0xffffff);
+        }
+        return 56 + size * 28;
+    }
+};
+
+/*
+    Read-only view of a train in the layout written by TrainFixedStringifier.
+    Fields are read out of the bytes when asked for, so a query only pays
+    for the stations it looks at instead of decoding the whole fixed-size
+    Train. The view shares the bytes with the cache they came from and
+    keeps them alive after they are evicted. Only cache hits are copy-free.
+    Stored records are compact and the file is not mapped, so a miss always
+    copies: the record is read into one buffer and TrainFixedExpander
+    expands it into a second one, which the cache then keeps.
+*/
+class TrainView {
+private:
+    std::shared_ptr<const char[]> data_;
+    int n_ = 0;
+
+    template<typename T>
+    T field(int offset) const {
+        T val;
+        memcpy(reinterpret_cast<char *>(&val), data_.get() + offset, sizeof(T));
+        return val;
+    }
+
+public:
+    TrainView() = default;
+
+    explicit TrainView(std::shared_ptr<const char[]> data) : data_(std::move(data)) {
+        n_ = field<int>(0);
+    }
+
+    int station_num() const { return n_; }
+
+    FixedString<20> train_id() const {
+        FixedString<20> id;
+        for (int i = 0; i < 20; i++) {
+            id[i] = data_[i + 4];
+        }
+        return id;
     }
+
+    int station(int i) const { return field<int>(24 + 4 * i); }
+
+    int seat_num() const { return field<int>(24 + 4 * n_); }
+
+    // price of the segment from station i to station i + 1
+    int price(int i) const { return field<int>(28 + 4 * n_ + 4 * i); }
+
+    // minutes after midnight
+    int start_time() const { return field<int>(28 + 8 * n_); }
+
+    int travel_time(int i) const { return field<int>(32 + 8 * n_ + 4 * i); }
+
+    int stopover(int i) const { return field<int>(32 + 12 * n_ + 4 * i); }
+
+    date start_sale_date() const { return field<date>(32 + 16 * n_); }
+
+    date end_sale_date() const { return field<date>(40 + 16 * n_); }
+
+    char type() const { return data_[48 + 16 * n_]; }
+
+    bool released() const { return data_[49 + 16 * n_] != 0; }
+
+    int seat_base() const { return field<int>(50 + 16 * n_); }
+
+    // fare from the first station to station i, so a ride costs price_sum(to) - price_sum(from)
+    int price_sum(int i) const { return field<int>(56 + 16 * n_ + 4 * i); }
+
+    // minutes from midnight of the departure day, whole days included
+    int arrival_minutes(int i) const { return field<int>(56 + 20 * n_ + 4 * i); }
+
+    int leaving_minutes(int i) const { return field<int>(56 + 24 * n_ + 4 * i); }
+
+    // the same as clock times, only for output
+    time arrival(int i) const { return to_time(arrival_minutes(i)); }
+
+    time leaving(int i) const { return to_time(leaving_minutes(i)); }
+
+    Train decode() const { return TrainAntiStringifier()(data_.get()); }
 };
 
 struct TrainPosition {
@@ -126,14 +478,23 @@ private:
     // MemoryRiver<Train> trains_;
     DynamicRiver<Train, TrainStringifier, TrainAntiStringifier, TrainSizeCalculator> trains_;
     MemoryRiver<FixedString<40>> stations_;
-    BPlusTree<FixedString<20>, int> train_map_;
-    BPlusTree<FixedString<40>, int> station_map_;
-    BPlusTree<int, TrainPosition> position_map_;
+    BPlusTree<FixedString<20>, int, PAGE_BYTES, false, true> train_map_;
+    BPlusTree<FixedString<40>, int, PAGE_BYTES, true, true> station_map_;
+    // entries are 12 bytes, 4 KiB pages already hold a few hundred
+    BPlusTree<int, TrainPosition, 4096, true> position_map_;
+    SeatInventory seats_;
+    // trains by id in the fixed layout TrainView reads, written through whenever a train is rewritten
+    lru_cache<int, std::shared_ptr<const char[]>> train_cache_;
+
+    static void check_format(const std::string& file_name);
 
 public:
     TrainSystem(const std::string& name = "train") :
-        trains_(name + "_trains.dat"), stations_(name + "_stations.dat"), train_map_(name + "_train_map.dat"),
-        station_map_(name + "_station_map.dat"), position_map_(name + "_position_map.dat") {}
+        trains_(name + "_trains.dat"), stations_(name + "_stations.dat"), train_map_(name + "_train_map.dat", true),
+        station_map_(name + "_station_map.dat", true), position_map_(name + "_position_map.dat"),
+        seats_(name + "_seats.dat"), train_cache_(train_cache_size) {
+        check_format(name + "_trains.dat");
+    }
 
     int train_id(const std::string& train_name);
 
@@ -153,16 +514,26 @@ public:
 
     Train query_train(int train_id);
 
+    std::optional<TrainView> view_train(const std::string& train_name);
+
+    TrainView view_train(int train_id);
+
     int query_station(const std::string& station_name, sjtu::vector<TrainPosition>& station_info);
 
     int query_station(int station_id, sjtu::vector<TrainPosition>& station_info);
 
-    void update_train(int train_id, Train& train);
+    void query_seats(const Train& train, int day, SeatRow& seats);
+
+    void query_seats(const TrainView& train, int day, SeatRow& seats);
+
+    void update_seats(const Train& train, int day, SeatRow& seats);
     
     void flush();
 
     void clear();
 
+    bool compact();
+
 };
 
 } // namespace sjtu
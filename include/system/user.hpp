@@ -5,7 +5,7 @@
 #include <string>
 
 #include "../utils/fixed_string.hpp"
-#include "../storage/bpt.hpp"
+#include "../storage/separated_bpt.hpp"
 #include "../stl/unordered_map.hpp"
 
 namespace sjtu {
@@ -52,11 +52,11 @@ public:
 
 class UserSystem {
 private:
-    BPlusTree<FixedString<20>, User> user_map_;
+    SeparatedBPlusTree<FixedString<20>, User> user_map_;
     sjtu::unordered_map<FixedString<20>, int> login_list_;
 
 public:
-    UserSystem(const std::string& file_name = "user") : user_map_(file_name + ".dat") {}
+    UserSystem(const std::string& file_name = "user") : user_map_(file_name + ".dat", true) {}
 
     ~UserSystem() = default;
 
@@ -79,6 +79,8 @@ public:
     void flush();
 
     void clear();
+
+    bool compact();
     
 };
 
@@ -2,6 +2,7 @@
 #define FIXED_STRING_HPP
 
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <cstring>
 #include <ostream>
@@ -38,6 +39,8 @@ public:
 
     std::string str() const;
 
+    uint64_t prefix() const;
+
     template<size_t len>
     friend bool operator==(const FixedString<len>& a, const FixedString<len>& b);
 
@@ -128,6 +131,22 @@ std::string FIXEDSTRING_TYPE::str() const {
     return ret;
 }
 
+/*
+    First 8 bytes as a big-endian word with everything after the terminator
+    zeroed, so comparing prefixes as integers agrees with strncmp.
+*/
+FIXEDSTRING_TEMPLATE_ARGS
+uint64_t FIXEDSTRING_TYPE::prefix() const {
+    uint64_t ret = 0;
+    bool ended = false;
+    for (size_t i = 0; i < 8; i++) {
+        unsigned char c = (i < length && !ended) ? static_cast<unsigned char>(data_[i]) : 0;
+        ended = ended || c == 0;
+        ret = (ret << 8) | c;
+    }
+    return ret;
+}
+
 FIXEDSTRING_TEMPLATE_ARGS
 bool operator==(const FIXEDSTRING_TYPE& a, const FIXEDSTRING_TYPE& b) {
 	return std::strncmp(a.data_, b.data_, length) == 0;
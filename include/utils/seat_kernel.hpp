@@ -0,0 +1,133 @@
+#ifndef SEAT_KERNEL_HPP
+#define SEAT_KERNEL_HPP
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SEAT_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace sjtu {
+
+/*
+    Range kernels over a row of seat counts, one int per segment. Unlike
+    the in-page search, these are built for every x86 target and pick
+    AVX2, SSE4.1 or plain loops when first called, from what the CPU
+    reports, so one binary runs everywhere. Other targets use the loops.
+*/
+
+enum class SeatKernelLevel {
+    Scalar,
+    SSE41,
+    AVX2
+};
+
+// fewest seats on segments [from, to), capped at bound
+inline int seat_min_scalar(const int* row, int from, int to, int bound) {
+    for (int i = from; i < to; i++) {
+        if (row[i] < bound) {
+            bound = row[i];
+        }
+    }
+    return bound;
+}
+
+// adds val to the seats on segments [from, to)
+inline void seat_add_scalar(int* row, int from, int to, int val) {
+    for (int i = from; i < to; i++) {
+        row[i] += val;
+    }
+}
+
+#ifdef SEAT_KERNEL_X86
+__attribute__((target("sse4.1")))
+inline int seat_min_sse41(const int* row, int from, int to, int bound) {
+    int i = from;
+    __m128i m = _mm_set1_epi32(bound);
+    for (; i + 4 <= to; i += 4) {
+        m = _mm_min_epi32(m, _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i)));
+    }
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_min_epi32(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return seat_min_scalar(row, i, to, _mm_cvtsi128_si32(m));
+}
+
+__attribute__((target("sse4.1")))
+inline void seat_add_sse41(int* row, int from, int to, int val) {
+    int i = from;
+    __m128i v = _mm_set1_epi32(val);
+    for (; i + 4 <= to; i += 4) {
+        __m128i* p = reinterpret_cast<__m128i*>(row + i);
+        _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), v));
+    }
+    seat_add_scalar(row, i, to, val);
+}
+
+__attribute__((target("avx2")))
+inline int seat_min_avx2(const int* row, int from, int to, int bound) {
+    int i = from;
+    __m256i m = _mm256_set1_epi32(bound);
+    for (; i + 8 <= to; i += 8) {
+        m = _mm256_min_epi32(m, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i)));
+    }
+    __m128i h = _mm_min_epi32(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+    h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+    h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+    return seat_min_scalar(row, i, to, _mm_cvtsi128_si32(h));
+}
+
+__attribute__((target("avx2")))
+inline void seat_add_avx2(int* row, int from, int to, int val) {
+    int i = from;
+    __m256i v = _mm256_set1_epi32(val);
+    for (; i + 8 <= to; i += 8) {
+        __m256i* p = reinterpret_cast<__m256i*>(row + i);
+        _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), v));
+    }
+    seat_add_scalar(row, i, to, val);
+}
+#endif
+
+// the best kernels this CPU runs
+inline SeatKernelLevel seat_kernel_level() {
+#ifdef SEAT_KERNEL_X86
+    static const SeatKernelLevel level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return SeatKernelLevel::AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return SeatKernelLevel::SSE41;
+        }
+        return SeatKernelLevel::Scalar;
+    }();
+    return level;
+#else
+    return SeatKernelLevel::Scalar;
+#endif
+}
+
+inline int seat_min(const int* row, int from, int to, int bound) {
+#ifdef SEAT_KERNEL_X86
+    using kernel_t = int (*)(const int*, int, int, int);
+    static const kernel_t kernel = seat_kernel_level() == SeatKernelLevel::AVX2 ? seat_min_avx2 :
+        seat_kernel_level() == SeatKernelLevel::SSE41 ? seat_min_sse41 : seat_min_scalar;
+    return kernel(row, from, to, bound);
+#else
+    return seat_min_scalar(row, from, to, bound);
+#endif
+}
+
+inline void seat_add(int* row, int from, int to, int val) {
+#ifdef SEAT_KERNEL_X86
+    using kernel_t = void (*)(int*, int, int, int);
+    static const kernel_t kernel = seat_kernel_level() == SeatKernelLevel::AVX2 ? seat_add_avx2 :
+        seat_kernel_level() == SeatKernelLevel::SSE41 ? seat_add_sse41 : seat_add_scalar;
+    kernel(row, from, to, val);
+#else
+    seat_add_scalar(row, from, to, val);
+#endif
+}
+
+} // namespace sjtu
+
+#endif // SEAT_KERNEL_HPP
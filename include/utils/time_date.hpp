@@ -35,6 +35,20 @@ struct time {
 
 };
 
+// the clock time and day offset of a count of minutes from midnight of day 0
+inline time to_time(int minutes) {
+    return time(minutes / 60 % 24, minutes % 60, minutes / 1440);
+}
+
+// days of the (non-leap) year before the first of each month
+constexpr int month_start[13] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365};
+
+/*
+    A day of the year without the year itself. As a number it counts the
+    days since January 1st, and numbers past the end of the year (or
+    before its start) wrap around, so a trip leaving on 12-31 arrives on
+    01-01; comparisons between days only hold within one year.
+*/
 struct date {
     int month_;
     int day_;
@@ -44,40 +58,22 @@ struct date {
     date(int month, int day) : month_(month), day_(day) {}
 
     date(int d) {
-        if (d >= 0 && d <= 29) {
-            month_ = 6;
-            day_ = d + 1;
+        d %= 365;
+        if (d < 0) {
+            d += 365;
         }
-        else if (d > 29 && d <= 60) {
-            month_ = 7;
-            day_ = d - 29;
-        }
-        else if (d > 60 && d <= 91) {
-            month_ = 8;
-            day_ = d - 60;
-        }
-        else if (d > 91 && d <= 121) {
-            month_ = 9;
-            day_ = d - 91;
-        }
-        else {
-            throw std::invalid_argument("Invalid day number");
+        month_ = 1;
+        while (d >= month_start[month_]) {
+            month_++;
         }
+        day_ = d - month_start[month_ - 1] + 1;
     }
 
     explicit operator int() const {
-        switch (month_) {
-            case 6:
-                return day_ - 1;
-            case 7:
-                return day_ + 29;
-            case 8:
-                return day_ + 60;
-            case 9:
-                return day_ + 91;
-            default:
-                return -1;
+        if (month_ < 1 || month_ > 12) {
+            return -1;
         }
+        return month_start[month_ - 1] + day_ - 1;
     }
 
     date operator+(int d) const {
@@ -86,6 +82,29 @@ struct date {
 
 };
 
+/*
+    The day of the sale window [start, end] that falls on the same date as
+    day d, or -1 if none does. Windows never span new year, so d may count
+    past either end of the year (a December train reaching a station in
+    January) and still picks out at most one day of the window.
+*/
+inline int day_in_window(int d, int start, int end) {
+    d = start + ((d - start) % 365 + 365) % 365;
+    return d <= end ? d : -1;
+}
+
+/*
+    Day d counted in the year of a train that runs on days [first, last],
+    where last may pass the end of the year. A day outside the run counts as
+    before or after it, whichever end is nearer, so it compares correctly with
+    the days of the run even across new year.
+*/
+inline int day_near_run(int d, int first, int last) {
+    int gap = 365 - (last - first + 1);
+    int lo = first - (gap > 0 ? gap / 2 : 0);
+    return lo + ((d - lo) % 365 + 365) % 365;
+}
+
 time parse_time(const std::string& str);
 
 date parse_date(const std::string& str);
@@ -1,6 +1,7 @@
 #ifndef TYPE_HELPER_HPP
 #define TYPE_HELPER_HPP
 
+#include <cstdint>
 #include <type_traits>
 #include <utility>
 
@@ -25,6 +26,14 @@ GENERATE_OPERATOR_CHECKS
 
 #undef GENERATE_OPERATOR_CHECKS
 
+// keys exposing a uint64_t prefix() whose order agrees with the key order
+template<typename T, typename = void>
+struct has_key_prefix_impl : std::false_type {};
+template<typename T>
+struct has_key_prefix_impl<T, std::enable_if_t<std::is_same_v<decltype(std::declval<const T&>().prefix()), uint64_t>>> : std::true_type {};
+template<typename T>
+inline constexpr bool has_key_prefix_v = has_key_prefix_impl<T>::value;
+
 } // namespace sjtu
 
 #endif // TYPE_HELPER_HPP
\ No newline at end of file
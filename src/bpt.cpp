@@ -44,6 +44,21 @@ int main() {
 		else if (op == "clear") {
 			bpt.clear();
 		}
+		else if (op == "stats") {
+			sjtu::TreeStats st = bpt.stats();
+			std::cout << "height " << st.height_ << "\n";
+			std::cout << "entries " << st.entries_ << "\n";
+			std::cout << "pages per level";
+			for (size_t pages : st.level_pages_) {
+				std::cout << ' ' << pages;
+			}
+			std::cout << "\n";
+			std::cout << "leaf fill avg " << st.avg_leaf_fill_ << " min " << st.min_leaf_fill_ << "\n";
+			std::cout << "internal fill avg " << st.avg_internal_fill_ << " min " << st.min_internal_fill_ << "\n";
+			std::cout << "free pages " << st.free_pages_ << "\n";
+			std::cout << "sequentiality " << st.sequentiality_ << "\n";
+			std::cout << (st.valid_ ? "valid" : "invalid: " + st.error_) << "\n";
+		}
 		else {
 			std::cout << "unknown operation" << std::endl;
 		}
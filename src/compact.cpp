@@ -0,0 +1,15 @@
+#include <iostream>
+
+#include "../include/system/ticket.hpp"
+
+// offline compaction of the data files in the current directory
+int main() {
+    std::cout << "开始整理当前目录下的 B+ 树文件..." << std::endl;
+    sjtu::TicketSystem sys;
+    if (!sys.compact()) {
+        std::cout << "部分文件未能替换，已保留原文件" << std::endl;
+        return 1;
+    }
+    std::cout << "整理完成" << std::endl;
+    return 0;
+}
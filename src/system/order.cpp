@@ -12,6 +12,12 @@ void OrderSystem::delete_order(const Order &order) {
     // order_map_.erase(order.info_, order);
 }
 
+void OrderSystem::update_order_status(const Order& order, TicketStatus status) {
+    user_order_map_.update(order.info_.user_, order, [status](Order& stored) {
+        stored.status_ = status;
+    });
+}
+
 void OrderSystem::query_order(const std::string &username, sjtu::vector<Order> &orders) {
     user_order_map_.find_all(FixedString<20>(username), orders);
 }
@@ -20,10 +26,6 @@ void OrderSystem::query_order(const std::string &username, sjtu::vector<Order> &
 //     order_map_.find_all(info, orders);
 // }
 
-void OrderSystem::get_pending_queue(sjtu::vector<Order> &pending_orders) {
-    queue_map_.serialize(pending_orders);
-}
-
 void OrderSystem::add_pending_order(const Order &order) {
     queue_map_.insert(order.info_.purchase_timestamp_, order);
 }
@@ -41,6 +43,12 @@ void OrderSystem::flush() {
     queue_map_.flush();
 }
 
+bool OrderSystem::compact() {
+    bool ok = user_order_map_.compact();
+    ok = queue_map_.compact() && ok;
+    return ok;
+}
+
 void OrderSystem::clear() {
     user_order_map_.clear();
     // order_map_.clear();
@@ -3,7 +3,9 @@
 #include "../../include/command/command.hpp"
 #include "../../include/system/order.hpp"
 #include "../../include/utils/fixed_string.hpp"
+#include "../../include/utils/seat_kernel.hpp"
 #include "../../include/result/result.hpp"
+#include "../../include/stl/unordered_map.hpp"
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -213,6 +215,22 @@ void TicketSystem::run(const volatile std::sig_atomic_t* signal_status) {
                 clear();
             }
         }
+        else if (cmd == "compact") {
+            if (!cmd_->check("", "")) {
+                std::cout << "-1\n";
+            }
+            else {
+                std::cout << (compact() ? "0\n" : "-1\n");
+            }
+        }
+        else if (cmd == "expire") {
+            if (!cmd_->check("d", "")) {
+                std::cout << "-1\n";
+            }
+            else {
+                expire();
+            }
+        }
         else if (cmd == "exit") {
             if (!cmd_->check("", "")) {
                 std::cout << "-1\n";
@@ -354,6 +372,25 @@ std::unique_ptr<Result> TicketSystem::handle(const Command &command) {
             res = new SuccessResult();
         }
     }
+    else if (cmd == "compact") {
+        if (!cmd_->check("", "")) {
+            res = new FailureResult();
+        }
+        else if (compact()) {
+            res = new SuccessResult();
+        }
+        else {
+            res = new FailureResult();
+        }
+    }
+    else if (cmd == "expire") {
+        if (!cmd_->check("d", "")) {
+            res = new FailureResult();
+        }
+        else {
+            expire(true, &res);
+        }
+    }
     else {
         res = new FailureResult();
     }
@@ -590,7 +627,7 @@ void TicketSystem::modify_profile(bool pack, Result **res) {
 
 void TicketSystem::add_train(bool pack, Result **res) {
     // std::cout << "add_train\n";
-    Train train;
+    Train train{};
     if (!verify_train_name(cmd_->arg('i'))) {
         if (pack) {
             if (res) *res = new FailureResult();
@@ -691,7 +728,7 @@ void TicketSystem::add_train(bool pack, Result **res) {
         return;
     }
     try {
-        train.startTime_ = parse_time(cmd_->arg('x'));
+        train.startTime_ = int(parse_time(cmd_->arg('x')));
     }
     catch(...) {
         // std::cerr << "bad time\n";
@@ -786,9 +823,8 @@ void TicketSystem::add_train(bool pack, Result **res) {
         std::cout << "-1\n";
         return;
     }
-    if (train.startSaleDate_.month_ < 6 || train.startSaleDate_.month_ > 8 ||
-            train.endSaleDate_.month_ < 6 || train.endSaleDate_.month_ > 8) {
-        // std::cerr << "bad month\n";
+    if (int(train.endSaleDate_) < int(train.startSaleDate_)) {
+        // std::cerr << "sale ends before it starts\n";
         if (pack) {
             if (res) *res = new FailureResult();
             return;
@@ -808,15 +844,6 @@ void TicketSystem::add_train(bool pack, Result **res) {
     }
     train.type_ = y[0];
     train.released_ = false;
-    train.arrivalTimes_[0] = train.startTime_;
-    for (int i = 1; i < train.stationNum_; i++) {
-        train.arrivalTimes_[i] = train.arrivalTimes_[i - 1] + (train.travelTimes_[i - 1] + train.stopoverTimes_[i - 1]);
-    }
-    for (int i = int(train.startSaleDate_); i <= int(train.endSaleDate_); i++) {
-        for (int j = 0; j < train.stationNum_ - 1; j++) {
-            train.seats_[i][j] = train.seatNum_;
-        }
-    }
     int ret = train_.add_train(train);
     if (pack) {
             if (!ret) {
@@ -900,16 +927,7 @@ void TicketSystem::query_train(bool pack, Result **res) {
         std::cout << "-1\n";
         return;
     }
-    if (d.month_ < 6 || d.month_ > 8) {
-        // std::cerr << "bad month\n";
-        if (pack) {
-            if (res) *res = new FailureResult();
-            return;
-        }
-        std::cout << "-1\n";
-        return;
-    }
-    auto ress = train_.query_train(cmd_->arg('i'));
+    auto ress = train_.view_train(cmd_->arg('i'));
     if (!ress.has_value()) {
         // std::cerr << "train not found\n";
         if (pack) {
@@ -919,8 +937,8 @@ void TicketSystem::query_train(bool pack, Result **res) {
         std::cout << "-1\n";
         return;
     }
-    Train train = ress.value();
-    if (int(d) < int(train.startSaleDate_) || int(d) > int(train.endSaleDate_)) {
+    const TrainView& train = ress.value();
+    if (int(d) < int(train.start_sale_date()) || int(d) > int(train.end_sale_date())) {
         // std::cerr << "no train at that date\n";
         if (pack) {
             if (res) *res = new FailureResult();
@@ -929,45 +947,43 @@ void TicketSystem::query_train(bool pack, Result **res) {
         std::cout << "-1\n";
         return;
     }
+    SeatRow seats;
+    train_.query_seats(train, int(d), seats);
     if (pack) {
         TrainInfo info{};
-        info.train_id_ = train.trainID_;
-        info.type_ = train.type_;
-        info.station_num_ = train.stationNum_;
+        info.train_id_ = train.train_id();
+        info.type_ = train.type();
+        info.station_num_ = train.station_num();
         info.query_date_ = d;
-        int price = 0;
-        for (int i = 0; i < train.stationNum_; i++) {
+        for (int i = 0; i < train.station_num(); i++) {
             TrainStationInfo station{};
-            station.station_name_ = FixedString<40>(train_.station_name(train.stations_[i]));
-            station.arrival_time_ = train.arrivalTimes_[i];
-            station.leaving_time_ = train.arrivalTimes_[i] + train.stopoverTimes_[i];
-            station.price_ = price;
-            station.seat_ = (i < train.stationNum_ - 1) ? train.seats_[int(d)][i] : -1;
+            station.station_name_ = FixedString<40>(train_.station_name(train.station(i)));
+            station.arrival_time_ = train.arrival(i);
+            station.leaving_time_ = train.leaving(i);
+            station.price_ = train.price_sum(i);
+            station.seat_ = (i < train.station_num() - 1) ? seats.seats_[i] : -1;
             station.has_arrival_ = (i != 0);
-            station.has_leaving_ = (i < train.stationNum_ - 1);
+            station.has_leaving_ = (i < train.station_num() - 1);
             info.stations_[i] = station;
-            price += train.prices_[i];
         }
         if (res) *res = new TrainResult(info);
         return;
     }
-    std::cout << train.trainID_.str() << " " << train.type_ << "\n";
-    int price = 0;
-    for (int i = 0; i < train.stationNum_; i++) {
-        std::string station_name = train_.station_name(train.stations_[i]);
-        time arrival_time = train.arrivalTimes_[i];
-        time leaving_time = train.arrivalTimes_[i] + train.stopoverTimes_[i];
+    std::cout << train.train_id().str() << " " << train.type() << "\n";
+    for (int i = 0; i < train.station_num(); i++) {
+        std::string station_name = train_.station_name(train.station(i));
+        time arrival_time = train.arrival(i);
+        time leaving_time = train.leaving(i);
         std::cout << station_name << " ";
         if (i) print_time_date(d, arrival_time, std::cout);
         else std::cout << "xx-xx xx:xx";
         std::cout << " -> ";
-        if (i < train.stationNum_ - 1) print_time_date(d, leaving_time, std::cout);
+        if (i < train.station_num() - 1) print_time_date(d, leaving_time, std::cout);
         else std::cout << "xx-xx xx:xx";
-        std::cout << " " << price << " ";
-        if (i < train.stationNum_ - 1) std::cout << train.seats_[int(d)][i];
+        std::cout << " " << train.price_sum(i) << " ";
+        if (i < train.station_num() - 1) std::cout << seats.seats_[i];
         else std::cout << "x";
         std::cout << "\n";
-        price += train.prices_[i];
     }
 }
 
@@ -1003,15 +1019,6 @@ void TicketSystem::query_ticket(bool pack, Result **res) {
         std::cout << "0\n";
         return;
     }
-    if (d.month_ < 6 || d.month_ > 9 || d.month_ == 9 && d.day_ > 3) {
-        // std::cerr << "no train at date\n";
-        if (pack) {
-            if (res) *res = new FailureResult();
-            return;
-        }
-        std::cout << "0\n";
-        return;
-    }
     if (!cmd_->arg('p').empty() && cmd_->arg('p') != "time" && cmd_->arg('p') != "cost") {
         // std::cerr << "bad sorting protocol\n";
         if (pack) {
@@ -1047,37 +1054,28 @@ void TicketSystem::query_ticket(bool pack, Result **res) {
             int train_id = start_trains[start_ptr].train_id_, 
                 spos = start_trains[start_ptr].pos_, 
                 epos = end_trains[end_ptr].pos_;
-            Train train = train_.query_train(train_id);
-            date first_date = train.startSaleDate_ + (train.arrivalTimes_[spos] + train.stopoverTimes_[spos]).day_offset_;
-            date last_date = train.endSaleDate_ + (train.arrivalTimes_[spos] + train.stopoverTimes_[spos]).day_offset_;
-            if (d_val >= int(first_date) && d_val <= int(last_date)) {
-                int depart = d_val - (train.arrivalTimes_[spos] + train.stopoverTimes_[spos]).day_offset_;
-                int min_seats = train.seatNum_;
-                for (int i = spos; i < epos; i++) {
-                    if (train.seats_[depart][i] < min_seats) {
-                        min_seats = train.seats_[depart][i];
-                    }
-                }
+            TrainView train = train_.view_train(train_id);
+            // the day the train leaves its first station, counted in the year of its sale window
+            int depart = day_in_window(d_val - train.leaving_minutes(spos) / 1440,
+                int(train.start_sale_date()), int(train.end_sale_date()));
+            if (depart >= 0) {
+                SeatRow seats;
+                train_.query_seats(train, depart, seats);
+                int min_seats = seat_min(seats.seats_, spos, epos, train.seat_num());
                 Ticket ticket;
-                ticket.train_id_ = train.trainID_;
-                // // std::cerr << train.trainID_ << std::endl;
-                ticket.start_station_ = train.stations_[spos];
-                ticket.end_station_ = train.stations_[epos];
+                ticket.train_id_ = train.train_id();
+                // // std::cerr << train.train_id() << std::endl;
+                ticket.start_station_ = train.station(spos);
+                ticket.end_station_ = train.station(epos);
                 ticket.departure_date_ = d_val;
-                // // std::cerr << train.arrivalTimes_[spos].day_offset_ << std::endl;
+                // // std::cerr << train.arrival_minutes(spos) / 1440 << std::endl;
                 // // std::cerr << d_val << " " << depart << std::endl;
                 // // std::cerr << date(d_val).month_ << " " << date(d_val).day_ << std::endl;
-                ticket.arrival_date_ = d_val
-                    + train.arrivalTimes_[epos].day_offset_
-                    - (train.arrivalTimes_[spos] + train.stopoverTimes_[spos]).day_offset_;
-                ticket.departure_time_ = train.arrivalTimes_[spos] + train.stopoverTimes_[spos];
-                ticket.arrival_time_ = train.arrivalTimes_[epos];
-                ticket.duration_ = int(ticket.arrival_time_) - int(ticket.departure_time_);
-                int price = 0;
-                for (int i = spos; i < epos; i++) {
-                    price += train.prices_[i];
-                }
-                ticket.price_ = price;
+                ticket.arrival_date_ = depart + train.arrival_minutes(epos) / 1440;
+                ticket.departure_time_ = train.leaving(spos);
+                ticket.arrival_time_ = train.arrival(epos);
+                ticket.duration_ = train.arrival_minutes(epos) - train.leaving_minutes(spos);
+                ticket.price_ = train.price_sum(epos) - train.price_sum(spos);
                 ticket.seat_ = min_seats;
                 tickets.push_back(ticket);
             }
@@ -1142,15 +1140,6 @@ void TicketSystem::query_transfer(bool pack, Result **res) {
         std::cout << "0\n";
         return;
     }
-    if (d.month_ < 6 || d.month_ > 9 || d.month_ == 9 && d.day_ > 3) {
-        // std::cerr << "no train at date\n";
-        if (pack) {
-            if (res) *res = new FailureResult();
-            return;
-        }
-        std::cout << "0\n";
-        return;
-    }
     if (!cmd_->arg('p').empty() && cmd_->arg('p') != "time" && cmd_->arg('p') != "cost") {
         // std::cerr << "bad sorting protocol\n";
         if (pack) {
@@ -1175,102 +1164,92 @@ void TicketSystem::query_transfer(bool pack, Result **res) {
         return;
     }
     int d_val = int(d);
-    sjtu::vector<Ticket> candidate_tickets;
+    sjtu::vector<TransferLeg> candidate_tickets;
     for (int i = 0; i < start_trains.size(); i++) {
-        Train train = train_.query_train(start_trains[i].train_id_);
+        TrainView train = train_.view_train(start_trains[i].train_id_);
         int start_pos = start_trains[i].pos_;
-        date first_date = train.startSaleDate_ + (train.arrivalTimes_[start_pos] + train.stopoverTimes_[start_pos]).day_offset_;
-        date last_date = train.endSaleDate_ + (train.arrivalTimes_[start_pos] + train.stopoverTimes_[start_pos]).day_offset_;
-        if (d_val < int(first_date) || d_val > int(last_date)) {
+        int departure_d = day_in_window(d_val - train.leaving_minutes(start_pos) / 1440,
+            int(train.start_sale_date()), int(train.end_sale_date()));
+        if (departure_d < 0) {
             continue;
         }
-        int price = 0;
-        int min_seats = train.seatNum_;
-        int departure_d = d_val - (train.arrivalTimes_[start_pos] + train.stopoverTimes_[start_pos]).day_offset_;
-        for (int j = start_pos + 1; j < train.stationNum_; j++) {
-            price += train.prices_[j - 1];
-            int cur_seat = train.seats_[departure_d][j - 1];
+        int min_seats = train.seat_num();
+        SeatRow seats;
+        train_.query_seats(train, departure_d, seats);
+        for (int j = start_pos + 1; j < train.station_num(); j++) {
+            int cur_seat = seats.seats_[j - 1];
             if (cur_seat < min_seats) {
                 min_seats = cur_seat;
             }
-            if (train.stations_[j] == end_station) {
+            if (train.station(j) == end_station) {
                 continue;
             }
             Ticket ticket;
-            ticket.train_id_ = train.trainID_;
+            ticket.train_id_ = train.train_id();
             ticket.start_station_ = start_station;
-            ticket.end_station_ = train.stations_[j];
-            ticket.departure_date_ = date(d_val);
-            ticket.departure_time_ = train.arrivalTimes_[start_pos] + train.stopoverTimes_[start_pos];
-            ticket.arrival_date_ = date(d_val
-                + train.arrivalTimes_[j].day_offset_
-                - (train.arrivalTimes_[start_pos] + train.stopoverTimes_[start_pos]).day_offset_);
-            ticket.arrival_time_ = train.arrivalTimes_[j];
-            ticket.duration_ = int(ticket.arrival_time_) - int(ticket.departure_time_);
-            ticket.price_ = price;
+            ticket.end_station_ = train.station(j);
+            ticket.departure_date_ = d;
+            ticket.departure_time_ = train.leaving(start_pos);
+            ticket.arrival_date_ = date(departure_d + train.arrival_minutes(j) / 1440);
+            ticket.arrival_time_ = train.arrival(j);
+            ticket.duration_ = train.arrival_minutes(j) - train.leaving_minutes(start_pos);
+            ticket.price_ = train.price_sum(j) - train.price_sum(start_pos);
             ticket.seat_ = min_seats;
-            candidate_tickets.push_back(ticket);
+            candidate_tickets.push_back(TransferLeg{ticket, departure_d * 1440 + train.arrival_minutes(j)});
         }
     }
-    candidate_tickets.sort(TicketEndStationCompare());
+    candidate_tickets.sort(TransferLegEndStationCompare());
     // // std::cerr << candidate_tickets.size() << std::endl;
     sjtu::vector<TransferTicket> tickets;
     for (int i = 0; i < end_trains.size(); i++) {
-        Train train = train_.query_train(end_trains[i].train_id_);
-        int price = 0;
-        for (int j = end_trains[i].pos_ - 1; j >= 0; j--) {
-            price += train.prices_[j];
-            Ticket t{};
-            t.end_station_ = train.stations_[j];
-            time real_departure_time = train.arrivalTimes_[j] + (j ? train.stopoverTimes_[j] : 0);
-            time departure_time = real_departure_time;
-            departure_time.day_offset_ = 0;
-            auto it = candidate_tickets.lower_bound(t, TicketEndStationCompare());
-            while (it != candidate_tickets.end() && (*it).end_station_ == train.stations_[j]) {
-                if ((*it).train_id_ == train.trainID_) {
+        TrainView train = train_.view_train(end_trains[i].train_id_);
+        int end_pos = end_trains[i].pos_;
+        for (int j = end_pos - 1; j >= 0; j--) {
+            TransferLeg t{};
+            t.ticket_.end_station_ = train.station(j);
+            int departure_minute = train.leaving_minutes(j) % 1440;
+            auto it = candidate_tickets.lower_bound(t, TransferLegEndStationCompare());
+            while (it != candidate_tickets.end() && (*it).ticket_.end_station_ == train.station(j)) {
+                const Ticket& first = (*it).ticket_;
+                if (first.train_id_ == train.train_id()) {
                     it++;
                     continue;
                 }
-                time last_arrival_time = (*it).arrival_time_;
-                last_arrival_time.day_offset_ = 0;
-                int last_arrival_date = int((*it).arrival_date_);
+                // days below are counted from the first day of the first train's sale year
+                int last_arrival_minute = (*it).arrival_minutes_ % 1440;
+                int last_arrival_date = (*it).arrival_minutes_ / 1440;
                 int earliest_departure_date =
-                    (int(last_arrival_time) <= int(departure_time)) ? last_arrival_date : (last_arrival_date + 1);
-                int station_day_offset = (train.arrivalTimes_[j] + train.stopoverTimes_[j]).day_offset_;
+                    (last_arrival_minute <= departure_minute) ? last_arrival_date : (last_arrival_date + 1);
+                int station_day_offset = train.leaving_minutes(j) / 1440;
                 int second_train_depart_date = earliest_departure_date - station_day_offset;
-                if (second_train_depart_date < int(train.startSaleDate_)) {
-                    second_train_depart_date = int(train.startSaleDate_);
+                // the second train leaves within the year that day falls in, so count from that year's start
+                int year_start = second_train_depart_date - ((second_train_depart_date % 365) + 365) % 365;
+                second_train_depart_date -= year_start;
+                if (second_train_depart_date < int(train.start_sale_date())) {
+                    second_train_depart_date = int(train.start_sale_date());
                 }
-                if (second_train_depart_date > int(train.endSaleDate_)) {
-                    // // std::cerr << train.trainID_ << " " << second_train_depart_date << std::endl;
+                if (second_train_depart_date > int(train.end_sale_date())) {
+                    // // std::cerr << train.train_id() << " " << second_train_depart_date << std::endl;
                     it++;
                     continue;
                 }
-                int departure_date = second_train_depart_date + station_day_offset;
-                int min_seats = train.seatNum_;
-                for (int k = j; k < end_trains[i].pos_; k++) {
-                    int cur_seat = train.seats_[second_train_depart_date][k];
-                    if (cur_seat < min_seats) {
-                        min_seats = cur_seat;
-                    }
-                }
+                SeatRow seats;
+                train_.query_seats(train, second_train_depart_date, seats);
+                int min_seats = seat_min(seats.seats_, j, end_pos, train.seat_num());
                 Ticket ticket;
-                ticket.train_id_ = train.trainID_;
-                ticket.start_station_ = train.stations_[j];
+                ticket.train_id_ = train.train_id();
+                ticket.start_station_ = train.station(j);
                 ticket.end_station_ = end_station;
-                ticket.departure_date_ = date(departure_date);
-                ticket.departure_time_ = real_departure_time;
-                ticket.arrival_date_ = date(departure_date
-                    + train.arrivalTimes_[end_trains[i].pos_].day_offset_
-                    - (train.arrivalTimes_[j] + train.stopoverTimes_[j]).day_offset_);
-                ticket.arrival_time_ = train.arrivalTimes_[end_trains[i].pos_];
-                ticket.duration_ = int(ticket.arrival_time_) - int(ticket.departure_time_);
-                ticket.price_ = price;
+                ticket.departure_date_ = date(second_train_depart_date + station_day_offset);
+                ticket.departure_time_ = train.leaving(j);
+                ticket.arrival_date_ = date(second_train_depart_date + train.arrival_minutes(end_pos) / 1440);
+                ticket.arrival_time_ = train.arrival(end_pos);
+                ticket.duration_ = train.arrival_minutes(end_pos) - train.leaving_minutes(j);
+                ticket.price_ = train.price_sum(end_pos) - train.price_sum(j);
                 ticket.seat_ = min_seats;
-                TransferTicket transfer_ticket;
-                transfer_ticket.first_ticket_ = *it;
-                transfer_ticket.second_ticket_ = ticket;
-                tickets.push_back(transfer_ticket);
+                int first_departure = (*it).arrival_minutes_ - first.duration_;
+                int last_arrival = (year_start + second_train_depart_date) * 1440 + train.arrival_minutes(end_pos);
+                tickets.push_back(TransferTicket{first, ticket, last_arrival - first_departure});
                 it++;
             }
         }
@@ -1453,8 +1432,9 @@ void TicketSystem::buy_ticket(bool pack, Result **res) {
         std::cout << "-1\n";
         return;
     }
-    int departure_date = int(d) - (train.arrivalTimes_[spos] + train.stopoverTimes_[spos]).day_offset_;
-    if (departure_date < int(train.startSaleDate_) || departure_date > int(train.endSaleDate_)) {
+    int departure_date = day_in_window(int(d) - train.leavingMinutes_[spos] / 1440,
+        int(train.startSaleDate_), int(train.endSaleDate_));
+    if (departure_date < 0) {
         // std::cerr << "outside selling period\n";
         if (pack) {
             if (res) *res = new FailureResult();
@@ -1463,24 +1443,19 @@ void TicketSystem::buy_ticket(bool pack, Result **res) {
         std::cout << "-1\n";
         return;
     }
-    int min_seats = train.seatNum_, price = 0;
-    for (int i = spos; i < epos; i++) {
-        int cur_seat = train.seats_[departure_date][i];
-        if (cur_seat < min_seats) {
-            min_seats = cur_seat;
-        }
-        price += train.prices_[i];
-    }
+    SeatRow seats;
+    train_.query_seats(train, departure_date, seats);
+    int min_seats = seat_min(seats.seats_, spos, epos, train.seatNum_);
+    int price = train.priceSums_[epos] - train.priceSums_[spos];
     if (min_seats < n) {
         if (accept_queue && n <= train.seatNum_) {
             int total_price = price * n;
             OrderInfo order_info{FixedString<20>(cmd_->arg('u')), order_timestamp_};
             Ticket ticket{FixedString<20>(cmd_->arg('i')), from_id, to_id,
-                d, train.arrivalTimes_[spos] + train.stopoverTimes_[spos],
-                d + (train.arrivalTimes_[epos].day_offset_
-                    - (train.arrivalTimes_[spos] + train.stopoverTimes_[spos]).day_offset_),
-                train.arrivalTimes_[epos],
-                int(train.arrivalTimes_[epos]) - int(train.arrivalTimes_[spos] + train.stopoverTimes_[spos]),
+                d, to_time(train.leavingMinutes_[spos]),
+                d + (train.arrivalMinutes_[epos] / 1440 - train.leavingMinutes_[spos] / 1440),
+                to_time(train.arrivalMinutes_[epos]),
+                train.arrivalMinutes_[epos] - train.leavingMinutes_[spos],
                 price, n
             };
             Order order{order_info, TicketStatus::Pending, ticket};
@@ -1504,18 +1479,15 @@ void TicketSystem::buy_ticket(bool pack, Result **res) {
         }
     }
     else {
-        for (int i = spos; i < epos; i++) {
-            train.seats_[departure_date][i] -= n;
-        }
-        train_.update_train(train_.train_id(cmd_->arg('i')), train);
+        seat_add(seats.seats_, spos, epos, -n);
+        train_.update_seats(train, departure_date, seats);
         int total_price = price * n;
         OrderInfo order_info{FixedString<20>(cmd_->arg('u')), order_timestamp_};
         Ticket ticket{FixedString<20>(cmd_->arg('i')), from_id, to_id,
-            d, train.arrivalTimes_[spos] + train.stopoverTimes_[spos],
-            d + (train.arrivalTimes_[epos].day_offset_
-                - (train.arrivalTimes_[spos] + train.stopoverTimes_[spos]).day_offset_),
-            train.arrivalTimes_[epos],
-            int(train.arrivalTimes_[epos]) - int(train.arrivalTimes_[spos] + train.stopoverTimes_[spos]),
+            d, to_time(train.leavingMinutes_[spos]),
+            d + (train.arrivalMinutes_[epos] / 1440 - train.leavingMinutes_[spos] / 1440),
+            to_time(train.arrivalMinutes_[epos]),
+            train.arrivalMinutes_[epos] - train.leavingMinutes_[spos],
             price, n
         };
         Order order{order_info, TicketStatus::Purchased, ticket};
@@ -1570,6 +1542,8 @@ void TicketSystem::query_order(bool pack, Result **res) {
                 std::cout << "[success] "; break;
             case TicketStatus::Refunded:
                 std::cout << "[refunded] "; break;
+            case TicketStatus::Expired:
+                std::cout << "[expired] "; break;
             default:
                 // std::cerr << "bad order\n";
                 std::cout << "[invalid] ";
@@ -1643,7 +1617,7 @@ void TicketSystem::refund_ticket(bool pack, Result **res) {
         return;
     }
     Order& order = orders[n - 1];
-    if (order.status_ == TicketStatus::Refunded) {
+    if (order.status_ == TicketStatus::Refunded || order.status_ == TicketStatus::Expired) {
         // std::cerr << "order already refunded\n";
         if (pack) {
             if (res) *res = new FailureResult();
@@ -1657,64 +1631,41 @@ void TicketSystem::refund_ticket(bool pack, Result **res) {
     }
     else if (order.status_ == TicketStatus::Purchased) {
         Train train = train_.query_train(order.ticket_.train_id_.str()).value();
-        int spos = -1, epos = -1;
+        // position of each station on the train, the last one if it repeats
+        sjtu::unordered_map<int, int> station_pos;
         for (int i = 0; i < train.stationNum_; i++) {
-            if (train.stations_[i] == order.ticket_.start_station_) {
-                spos = i;
-            }
-            if (train.stations_[i] == order.ticket_.end_station_) {
-                epos = i;
-            }
-        }
-        int departure_date = int(order.ticket_.departure_date_)
-            - (train.arrivalTimes_[spos] + train.stopoverTimes_[spos]).day_offset_;
-        for (int i = spos; i < epos; i++) {
-            train.seats_[departure_date][i] += order.ticket_.seat_;
-        }
-        // train_.update_train(train_.train_id(train.trainID_.str()), train);
-        sjtu::vector<Order> queue;
-        order_.get_pending_queue(queue);
-        queue.sort(OrderTimeCompare());
-        for (int i = 0; i < queue.size(); i++) {
-            Order& cur_order = queue[i];
+            station_pos[train.stations_[i]] = i;
+        }
+        int spos = station_pos[order.ticket_.start_station_];
+        int epos = station_pos[order.ticket_.end_station_];
+        int departure_date = day_in_window(int(order.ticket_.departure_date_) - train.leavingMinutes_[spos] / 1440,
+            int(train.startSaleDate_), int(train.endSaleDate_));
+        SeatRow seats;
+        train_.query_seats(train, departure_date, seats);
+        seat_add(seats.seats_, spos, epos, order.ticket_.seat_);
+        SeatIndex index(seats, train.stationNum_ - 1);
+        order_.walk_pending_queue([&](const Order& cur_order) {
             if (cur_order.ticket_.train_id_ != order.ticket_.train_id_) {
-                continue;
-            }
-            int cur_spos = -1, cur_epos = -1;
-            for (int j = 0; j < train.stationNum_; j++) {
-                if (train.stations_[j] == cur_order.ticket_.start_station_) {
-                    cur_spos = j;
-                }
-                if (train.stations_[j] == cur_order.ticket_.end_station_) {
-                    cur_epos = j;
-                }
+                return;
             }
+            int cur_spos = station_pos[cur_order.ticket_.start_station_];
+            int cur_epos = station_pos[cur_order.ticket_.end_station_];
             if (cur_epos <= spos || cur_spos >= epos) {
-                continue;
+                return;
             }
-            int cur_departure_date = int(cur_order.ticket_.departure_date_)
-                - (train.arrivalTimes_[cur_spos] + train.stopoverTimes_[cur_spos]).day_offset_;
+            int cur_departure_date = day_in_window(int(cur_order.ticket_.departure_date_) - train.leavingMinutes_[cur_spos] / 1440,
+                int(train.startSaleDate_), int(train.endSaleDate_));
             if (departure_date != cur_departure_date) {
-                continue;
-            }
-            int min_seats = train.seatNum_;
-            for (int j = cur_spos; j < cur_epos; j++) {
-                int cur_seat = train.seats_[departure_date][j];
-                if (cur_seat < min_seats) {
-                    min_seats = cur_seat;
-                }
+                return;
             }
-            if (min_seats >= cur_order.ticket_.seat_) {
-                for (int j = cur_spos; j < cur_epos; j++) {
-                    train.seats_[departure_date][j] -= cur_order.ticket_.seat_;
-                }
+            if (index.min(cur_spos, cur_epos) >= cur_order.ticket_.seat_) {
+                index.add(cur_spos, cur_epos, -cur_order.ticket_.seat_);
                 order_.remove_pending_order(cur_order.info_.purchase_timestamp_);
-                order_.delete_order(cur_order);
-                cur_order.status_ = TicketStatus::Purchased;
-                order_.add_order(cur_order);
+                order_.update_order_status(cur_order, TicketStatus::Purchased);
             }
-        }
-        train_.update_train(train_.train_id(train.trainID_.str()), train);
+        });
+        index.store(seats);
+        train_.update_seats(train, departure_date, seats);
     }
     else {
         // std::cerr << "unexpected invalid order\n";
@@ -1725,9 +1676,7 @@ void TicketSystem::refund_ticket(bool pack, Result **res) {
         std::cout << "-1\n";
         return;
     }
-    order_.delete_order(order);
-    order.status_ = TicketStatus::Refunded;
-    order_.add_order(order);
+    order_.update_order_status(order, TicketStatus::Refunded);
     if (pack) {
         if (res) *res = new SuccessResult();
         return;
@@ -1752,4 +1701,54 @@ void TicketSystem::clear() {
     }
 }
 
+// the system has no clock of its own, so the caller passes the current date
+void TicketSystem::expire(bool pack, Result **res) {
+    date today;
+    try {
+        today = parse_date(cmd_->arg('d'));
+    }
+    catch(...) {
+        // std::cerr << "bad date syntax\n";
+        if (pack) {
+            if (res) *res = new FailureResult();
+            return;
+        }
+        std::cout << "-1\n";
+        return;
+    }
+    /*
+        Dates carry no year, so an order's departure is counted in the year
+        of its train's sale window and today is placed next to that train's
+        run: a January departure of a December train is not stale on 12-31.
+    */
+    int ret = order_.expire_pending_orders([&](const Order& order) {
+        TrainView train = train_.view_train(order.ticket_.train_id_.str()).value();
+        int spos = 0;
+        for (int i = 0; i < train.station_num(); i++) {
+            if (train.station(i) == order.ticket_.start_station_) {
+                spos = i;
+            }
+        }
+        int offset = train.leaving_minutes(spos) / 1440;
+        int start = int(train.start_sale_date()), end = int(train.end_sale_date());
+        int departure = day_in_window(int(order.ticket_.departure_date_) - offset, start, end) + offset;
+        int last = end + train.leaving_minutes(train.station_num() - 2) / 1440;
+        return departure < day_near_run(int(today), start, last);
+    });
+    if (pack) {
+        if (res) *res = new SuccessResult();
+        return;
+    }
+    std::cout << ret << '\n';
+}
+
+// rewrites every B+ tree file to reclaim freed pages, without reloading data
+bool TicketSystem::compact() {
+    flush();
+    bool ok = user_.compact();
+    ok = train_.compact() && ok;
+    ok = order_.compact() && ok;
+    return ok;
+}
+
 } // namespace sjtu
\ No newline at end of file
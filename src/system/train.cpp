@@ -1,9 +1,121 @@
 #include "../../include/system/train.hpp"
 
+#include <algorithm>
+#include <climits>
 #include <optional>
 #include <cstring>
+#include <fstream>
+#include <stdexcept>
 
 namespace sjtu {
+static void seat_fill(SeatRow& seats, int seat_num) {
+    for (int i = 0; i < max_stations; i++) {
+        seats.seats_[i] = seat_num;
+    }
+}
+
+// appends days rows with seat_num seats on every segment, returns the first
+int SeatInventory::allocate(int days, int seat_num) {
+    SeatRow seats;
+    seat_fill(seats, seat_num);
+    int base = rows_.write(seats);
+    for (int i = 1; i < days; i++) {
+        rows_.write(seats);
+    }
+    return base;
+}
+
+void SeatInventory::read(int row, SeatRow& seats) {
+    rows_.read(seats, row);
+}
+
+void SeatInventory::write(int row, SeatRow& seats) {
+    rows_.update(seats, row);
+}
+
+void SeatInventory::flush() {
+    rows_.flush();
+}
+
+void SeatInventory::clear() {
+    rows_.clear();
+}
+
+SeatIndex::SeatIndex(const SeatRow& seats, int n) : n_(n) {
+    if (n_ > 0) {
+        build(1, 0, n_ - 1, seats);
+    }
+}
+
+void SeatIndex::build(int node, int l, int r, const SeatRow& seats) {
+    add_[node] = 0;
+    if (l == r) {
+        min_[node] = seats.seats_[l];
+        return;
+    }
+    int mid = (l + r) / 2;
+    build(node * 2, l, mid, seats);
+    build(node * 2 + 1, mid + 1, r, seats);
+    min_[node] = std::min(min_[node * 2], min_[node * 2 + 1]);
+}
+
+int SeatIndex::min(int node, int l, int r, int from, int to) const {
+    if (from <= l && r < to) {
+        return min_[node];
+    }
+    int mid = (l + r) / 2;
+    int ans = INT_MAX;
+    if (from <= mid) {
+        ans = std::min(ans, min(node * 2, l, mid, from, to));
+    }
+    if (to > mid + 1) {
+        ans = std::min(ans, min(node * 2 + 1, mid + 1, r, from, to));
+    }
+    return ans + add_[node];
+}
+
+void SeatIndex::add(int node, int l, int r, int from, int to, int val) {
+    if (from <= l && r < to) {
+        min_[node] += val;
+        add_[node] += val;
+        return;
+    }
+    int mid = (l + r) / 2;
+    if (from <= mid) {
+        add(node * 2, l, mid, from, to, val);
+    }
+    if (to > mid + 1) {
+        add(node * 2 + 1, mid + 1, r, from, to, val);
+    }
+    min_[node] = std::min(min_[node * 2], min_[node * 2 + 1]) + add_[node];
+}
+
+void SeatIndex::store(int node, int l, int r, int acc, SeatRow& seats) const {
+    if (l == r) {
+        seats.seats_[l] = min_[node] + acc;
+        return;
+    }
+    int mid = (l + r) / 2;
+    store(node * 2, l, mid, acc + add_[node], seats);
+    store(node * 2 + 1, mid + 1, r, acc + add_[node], seats);
+}
+
+int SeatIndex::min(int from, int to) const {
+    return from < to ? min(1, 0, n_ - 1, from, to) : INT_MAX;
+}
+
+void SeatIndex::add(int from, int to, int val) {
+    if (from < to) {
+        add(1, 0, n_ - 1, from, to, val);
+    }
+}
+
+void SeatIndex::store(SeatRow& seats) const {
+    if (n_ > 0) {
+        store(1, 0, n_ - 1, 0, seats);
+    }
+}
+
 int TrainSystem::train_id(const std::string& train_name) {
     auto ans = train_map_.find(FixedString<20>(train_name));
     return ans.has_value() ? ans.value() : -1;
@@ -25,6 +137,13 @@ int TrainSystem::add_train(Train& train) {
     if (ans.has_value()) {
         return -1;
     }
+    for (int i = 0; i < train.stationNum_; i++) {
+        train.priceSums_[i] = i ? train.priceSums_[i - 1] + train.prices_[i - 1] : 0;
+        train.arrivalMinutes_[i] = i ? train.leavingMinutes_[i - 1] + train.travelTimes_[i - 1] : train.startTime_;
+        train.leavingMinutes_[i] = train.arrivalMinutes_[i] + train.stopoverTimes_[i];
+    }
+    // seat rows come with the release, a train deleted before it never takes any
+    train.seat_base_ = 0;
     diskpos_t train_id = trains_.write(train);
     train_map_.insert(train.trainID_, train_id);
     return 0;
@@ -46,12 +165,12 @@ int TrainSystem::delete_train(const std::string &train_name) {
     if (!ans.has_value()) {
         return -1;
     }
-    Train train;
-    trains_.read(train, ans.value());
-    if (train.released_) {
+    if (view_train(ans.value()).released()) {
         return -1;
     }
     train_map_.erase(FixedString<20>(train_name), ans.value());
+    train_cache_.erase(ans.value());
+    trains_.erase(ans.value());
     return 0;
 }
 
@@ -60,15 +179,23 @@ int TrainSystem::release_train(const std::string &train_name) {
     if (!ans.has_value()) {
         return -1;
     }
-    Train train;
-    trains_.read(train, ans.value());
+    Train train = query_train(ans.value());
     if (train.released_) {
         return -1;
     }
     train.released_ = true;
-    trains_.update(train, ans.value());
+    train.seat_base_ = seats_.allocate(int(train.endSaleDate_) - int(train.startSaleDate_) + 1, train.seatNum_);
+    int train_id = trains_.update(train, ans.value());
+    if (train_id != ans.value()) {
+        // moved as the record grew (old fixed layout, or a longer seat_base_); nothing else refers to it before release
+        train_map_.erase(train.trainID_, ans.value());
+        train_map_.insert(train.trainID_, train_id);
+        train_cache_.erase(ans.value());
+    }
+    int len = 0;
+    train_cache_.put(train_id, std::shared_ptr<const char[]>(TrainFixedStringifier()(train, len)));
     for (int i = 0; i < train.stationNum_; i++) {
-        position_map_.insert(train.stations_[i], {ans.value(), i});
+        position_map_.insert(train.stations_[i], {train_id, i});
     }
     return 0;
 }
@@ -78,15 +205,48 @@ std::optional<Train> TrainSystem::query_train(const std::string& train_name) {
     if (!ans.has_value()) {
         return std::nullopt;
     }
-    Train train;
-    trains_.read(train, ans.value());
-    return train;
+    return query_train(ans.value());
 }
 
 Train TrainSystem::query_train(int train_id) {
-    Train train;
-    trains_.read(train, train_id);
-    return train;
+    return view_train(train_id).decode();
+}
+
+std::optional<TrainView> TrainSystem::view_train(const std::string& train_name) {
+    auto ans = train_map_.find(FixedString<20>(train_name));
+    if (!ans.has_value()) {
+        return std::nullopt;
+    }
+    return view_train(ans.value());
+}
+
+// every record written since the compact format starts with its header, so the first one tells the file apart
+void TrainSystem::check_format(const std::string& file_name) {
+    std::ifstream file(file_name, std::ios::binary);
+    uint32_t header = 0;
+    if (file && file.read(reinterpret_cast<char *>(&header), 4) && header >> 24 != train_format_compact) {
+        throw std::runtime_error(file_name + " is not in the current storage format, rebuild the data");
+    }
+}
+
+TrainView TrainSystem::view_train(int train_id) {
+    auto *cached = train_cache_.get(train_id);
+    if (cached) {
+        return TrainView(*cached);
+    }
+    int len = 0;
+    char *bytes = trains_.read_bytes(train_id, len);
+    uint32_t header;
+    memcpy(&header, bytes, 4);
+    if (header >> 24 == train_format_compact) {
+        // the view reads the fixed layout, so a miss copies the record a second time while expanding it
+        char *fixed = TrainFixedExpander()(bytes, len);
+        delete []bytes;
+        bytes = fixed;
+    }
+    std::shared_ptr<const char[]> data(bytes);
+    train_cache_.put(train_id, data);
+    return TrainView(data);
 }
 
 int TrainSystem::query_station(const std::string& station_name, sjtu::vector<TrainPosition>& station_info) {
@@ -104,8 +264,25 @@ int TrainSystem::query_station(int station_id, sjtu::vector<TrainPosition>& stat
     return 0;
 }
 
-void TrainSystem::update_train(int train_id, Train& train) {
-    trains_.update(train, train_id);
+// day is the date the train leaves its first station; before the release every seat is left
+void TrainSystem::query_seats(const Train& train, int day, SeatRow& seats) {
+    if (!train.released_) {
+        seat_fill(seats, train.seatNum_);
+        return;
+    }
+    seats_.read(train.seat_base_ + day - int(train.startSaleDate_), seats);
+}
+
+void TrainSystem::query_seats(const TrainView& train, int day, SeatRow& seats) {
+    if (!train.released()) {
+        seat_fill(seats, train.seat_num());
+        return;
+    }
+    seats_.read(train.seat_base() + day - int(train.start_sale_date()), seats);
+}
+
+void TrainSystem::update_seats(const Train& train, int day, SeatRow& seats) {
+    seats_.write(train.seat_base_ + day - int(train.startSaleDate_), seats);
 }
 
 void TrainSystem::flush() {
@@ -114,14 +291,24 @@ void TrainSystem::flush() {
     train_map_.flush();
     station_map_.flush();
     position_map_.flush();
+    seats_.flush();
+}
+
+bool TrainSystem::compact() {
+    bool ok = train_map_.compact();
+    ok = station_map_.compact() && ok;
+    ok = position_map_.compact() && ok;
+    return ok;
 }
 
 void TrainSystem::clear() {
+    train_cache_.clear();
     trains_.clear();
     stations_.clear();
     train_map_.clear();
     station_map_.clear();
     position_map_.clear();
+    seats_.clear();
 }
 
 } // namespace sjtu
\ No newline at end of file
@@ -109,9 +109,8 @@ std::optional<User> UserSystem::modify_profile(const std::string &cur_username,
         // std::cerr << "+g\n";
         return std::nullopt;
     }
-    user_map_.erase(FixedString<20>(username), target_user.value());
     User modified_user(username, password == "" ? target_user->password() : password, name == "" ? target_user->name() : name, email == "" ? target_user->email() : email, privilege == -1 ? target_user->privilege() : privilege);
-    user_map_.insert(FixedString<20>(username), modified_user);
+    user_map_.upsert(FixedString<20>(username), modified_user);
     if (cur_username == username && privilege != -1) {
         login_list_[FixedString<20>(username)] = privilege;
     }
@@ -127,4 +126,8 @@ void UserSystem::clear() {
     login_list_.clear();
 }
 
+bool UserSystem::compact() {
+    return user_map_.compact();
+}
+
 } // namespace sjtu
\ No newline at end of file
@@ -0,0 +1,645 @@
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "../include/storage/bloom.hpp"
+#include "../include/storage/bpt.hpp"
+#include "../include/storage/search.hpp"
+#include "../include/storage/separated_bpt.hpp"
+#include "../include/utils/fixed_string.hpp"
+
+using sjtu::BPlusTree;
+using sjtu::FixedString;
+using sjtu::SeparatedBPlusTree;
+
+namespace fs = std::filesystem;
+
+struct Record {
+    int id_;
+    int payload_[64];
+};
+
+struct RecordIndexer {
+    int operator()(const Record& r) const {
+        return r.id_;
+    }
+};
+
+static void remove_test_files() {
+    for (const auto& entry : fs::directory_iterator(".")) {
+        if (entry.path().filename().string().rfind("bpt_test_", 0) == 0) {
+            fs::remove(entry.path());
+        }
+    }
+}
+
+template<typename T>
+static void check_search(const T* keys, int n, const T& key) {
+    int lower = 0, upper = 0;
+    while (lower < n && keys[lower] < key) {
+        lower++;
+    }
+    while (upper < n && !(key < keys[upper])) {
+        upper++;
+    }
+    assert(sjtu::key_lower_bound(keys, n, key) == lower);
+    assert(sjtu::key_upper_bound(keys, n, key) == upper);
+}
+
+int main() {
+    remove_test_files();
+
+    {
+        int keys[37];
+        long long wide[37];
+        unsigned short small[37];
+        FixedString<8> strs[37];
+        for (int i = 0; i < 37; i++) {
+            keys[i] = i / 3 * 2 - 10;
+            wide[i] = static_cast<long long>(keys[i]) * (1LL << 33);
+            small[i] = static_cast<unsigned short>(i / 3 * 2);
+            strs[i] = FixedString<8>("s" + std::to_string(100 + i / 3 * 2));
+        }
+        for (int n = 0; n <= 37; n++) {
+            for (int v = -13; v <= 16; v++) {
+                check_search(keys, n, v);
+                check_search(wide, n, static_cast<long long>(v) * (1LL << 33));
+                check_search(small, n, static_cast<unsigned short>(v + 13));
+                check_search(strs, n, FixedString<8>("s" + std::to_string(100 + v + 13)));
+            }
+        }
+    }
+
+    {
+        BPlusTree<int, int> bpt("bpt_test_plain.dat");
+        assert(bpt.empty());
+        for (int i = 0; i < 3000; i++) {
+            assert(bpt.insert(i % 500, i));
+        }
+        assert(!bpt.insert(7, 7));
+        sjtu::vector<int> vec;
+        bpt.find_all(7, vec);
+        assert(vec.size() == 6);
+        for (int i = 0; i < 6; i++) {
+            assert(vec[i] == 7 + i * 500);
+        }
+        assert(bpt.find(7, 1007).value() == 1007);
+        assert(!bpt.find(7, 1008).has_value());
+        for (int i = 0; i < 3000; i += 2) {
+            bpt.erase(i % 500, i);
+        }
+        assert(!bpt.find(2).has_value());
+        assert(bpt.find(3).value() == 3);
+    }
+
+    {
+        BPlusTree<int, int> bpt("bpt_test_plain.dat");
+        sjtu::vector<int> vec;
+        bpt.serialize(vec);
+        assert(vec.size() == 1500);
+        bpt.find_all(499, vec);
+        assert(vec.size() == 6);
+        assert(vec[5] == 2999);
+    }
+
+    {
+        // tiny pages give a deep tree
+        BPlusTree<int, int, 512> bpt("bpt_test_small.dat");
+        for (int i = 0; i < 5000; i++) {
+            assert(bpt.insert((i * 7919) % 5000, i));
+        }
+        for (int i = 0; i < 5000; i += 2) {
+            bpt.erase((i * 7919) % 5000, i);
+        }
+        sjtu::vector<int> vec;
+        bpt.serialize(vec);
+        assert(vec.size() == 2500);
+        bpt.rebalance();
+        sjtu::TreeStats st = bpt.stats();
+        assert(st.valid_ && st.entries_ == 2500 && st.height_ >= 3);
+        assert(st.min_leaf_fill_ >= sjtu::MERGE_FILL && st.min_internal_fill_ > 0);
+        for (int i = 1; i < 5000; i += 2) {
+            assert(bpt.find((i * 7919) % 5000).value() == i);
+        }
+    }
+
+    {
+        // runs of one key span many leaves, separators tell their values apart
+        BPlusTree<int, int, 512> bpt("bpt_test_runs.dat");
+        for (int i = 0; i < 6000; i++) {
+            assert(bpt.insert(i % 3, (i * 7919) % 6000));
+        }
+        assert(!bpt.insert(1, 7919 % 6000));
+        for (int i = 0; i < 6000; i += 3) {
+            bpt.erase(i % 3, (i * 7919) % 6000);
+        }
+        bpt.rebalance();
+        sjtu::TreeStats st = bpt.stats();
+        assert(st.valid_ && st.entries_ == 4000 && st.height_ >= 3);
+        for (int i = 0; i < 6000; i++) {
+            assert(bpt.find(i % 3, (i * 7919) % 6000).has_value() == (i % 3 != 0));
+        }
+        sjtu::vector<int> vec;
+        bpt.find_all(1, vec);
+        assert(vec.size() == 2000);
+        for (size_t i = 1; i < vec.size(); i++) {
+            assert(vec[i - 1] < vec[i]);
+        }
+        assert(bpt.update(1, vec[0], [](int& v) { v = 6001; }) && !bpt.find(1, vec[0]).has_value());
+        assert(bpt.find(1, 6001).has_value() && bpt.stats().valid_);
+    }
+
+    {
+        BPlusTree<int, int> bpt("bpt_test_update.dat");
+        for (int i = 0; i < 1000; i++) {
+            assert(bpt.insert(i % 10, i));
+        }
+        // stays in its slot
+        assert(!bpt.update(3, 503, [](int& v) { v = 513; }));
+        assert(bpt.update(3, 503, [](int& v) { v = 505; }));
+        assert(bpt.find(3, 505).has_value() && !bpt.find(3, 503).has_value());
+        // moves to another position
+        assert(bpt.update(3, 505, [](int& v) { v = 2000; }));
+        sjtu::vector<int> vec;
+        bpt.find_all(3, vec);
+        assert(vec.size() == 100 && vec[99] == 2000);
+        assert(!bpt.update(3, 505, [](int& v) { v = 1; }));
+        assert(!bpt.upsert(3, 2000));
+        assert(bpt.upsert(11, 7));
+        assert(bpt.find(11).value() == 7);
+    }
+
+    {
+        // appends at the right end split 90/10, so pages stay nearly full
+        BPlusTree<int, int> asc("bpt_test_asc.dat");
+        BPlusTree<int, int> desc("bpt_test_desc.dat");
+        for (int i = 0; i < 20000; i++) {
+            assert(asc.insert(i, i));
+            assert(desc.insert(20000 - i, i));
+        }
+        asc.flush();
+        desc.flush();
+        assert(fs::file_size("bpt_test_asc.dat") * 3 < fs::file_size("bpt_test_desc.dat") * 2);
+        for (int i = 0; i < 20000; i += 7) {
+            assert(asc.find(i).value() == i);
+            asc.erase(i, i);
+        }
+        for (int i = 20000; i < 21000; i++) {
+            assert(asc.insert(i, i));
+        }
+        sjtu::vector<int> vec;
+        asc.serialize(vec);
+        assert(vec.size() == 21000 - 2858);
+        for (size_t i = 1; i < vec.size(); i++) {
+            assert(vec[i - 1] < vec[i]);
+        }
+    }
+
+    {
+        // long keys sharing their first 8 bytes fall back to full comparison
+        BPlusTree<FixedString<24>, int> bpt("bpt_test_prefix.dat");
+        for (int i = 0; i < 2000; i++) {
+            assert(bpt.insert(FixedString<24>("station_" + std::to_string(i % 300)), i));
+            assert(bpt.insert(FixedString<24>("st" + std::to_string(i % 7)), i));
+        }
+        sjtu::vector<int> vec;
+        bpt.find_all(FixedString<24>("station_42"), vec);
+        assert(vec.size() == 7);
+        assert(vec[0] == 42 && vec[6] == 1842);
+        bpt.find_all(FixedString<24>("st3"), vec);
+        assert(vec.size() == 286);
+        assert(!bpt.find(FixedString<24>("station_")).has_value());
+        assert(!bpt.find(FixedString<24>("station_300")).has_value());
+    }
+
+    {
+        // compressed leaves hold several times more entries in the same bytes
+        BPlusTree<int, int, 512, true> packed("bpt_test_packed.dat");
+        BPlusTree<int, int, 512> plain("bpt_test_unpacked.dat");
+        for (int i = 0; i < 20000; i++) {
+            assert(packed.insert(i / 4, i));
+            assert(plain.insert(i / 4, i));
+        }
+        for (int i = 0; i < 20000; i += 3) {
+            packed.erase(i / 4, i);
+        }
+        assert(packed.update(7, 29, [](int& v) { v = 1 << 30; }));
+        packed.flush();
+        plain.flush();
+        assert(fs::file_size("bpt_test_packed.dat") * 2 < fs::file_size("bpt_test_unpacked.dat"));
+        sjtu::vector<int> vec;
+        packed.find_all(7, vec);
+        assert(vec.size() == 3 && vec[0] == 28 && vec[1] == 31 && vec[2] == (1 << 30));
+        packed.serialize(vec);
+        assert(vec.size() == 20000 - 6667);
+    }
+
+    {
+        BPlusTree<FixedString<24>, int, 512, true> bpt("bpt_test_packed_str.dat");
+        for (int i = 0; i < 3000; i++) {
+            assert(bpt.insert(FixedString<24>("station_" + std::to_string(i % 500)), i));
+        }
+        bpt.flush();
+        for (int i = 0; i < 3000; i += 2) {
+            bpt.erase(FixedString<24>("station_" + std::to_string(i % 500)), i);
+        }
+        sjtu::vector<int> vec;
+        bpt.find_all(FixedString<24>("station_77"), vec);
+        assert(vec.size() == 6 && vec[0] == 77 && vec[5] == 2577);
+        bpt.serialize(vec);
+        assert(vec.size() == 1500);
+    }
+
+    {
+        // a walk through a snapshot sees the tree as it was while the visitor rewrites it
+        BPlusTree<int, int, 512> bpt("bpt_test_snapshot.dat");
+        BPlusTree<int, int, 512, true> packed("bpt_test_snapshot_packed.dat");
+        for (int i = 0; i < 6000; i++) {
+            assert(bpt.insert(i, i) && packed.insert(i, i));
+        }
+        sjtu::TreeSnapshot snap = bpt.snapshot();
+        sjtu::TreeSnapshot packed_snap = packed.snapshot();
+        int seen = 0;
+        auto visit = [&seen](auto& tree) {
+            return [&seen, &tree](const int& key, const int& val) {
+                assert(key == seen && val == seen);
+                seen++;
+                // the walk still reads the value the previous call negated
+                tree.erase(key, key == 0 ? val : -val);
+                // the next pair changes before the walk reaches it, new pairs land after the walk
+                tree.update(key + 1, key + 1, [](int& v) { v = -v; });
+                if (key % 3 == 0) {
+                    assert(tree.insert(key + 6000, key));
+                }
+                if (key % 1000 == 999) {
+                    tree.flush();
+                }
+            };
+        };
+        bpt.for_each(snap, visit(bpt));
+        assert(seen == 6000);
+        seen = 0;
+        packed.for_each(packed_snap, visit(packed));
+        assert(seen == 6000);
+        bpt.release(snap);
+        packed.release(packed_snap);
+        assert(bpt.stats().valid_ && bpt.stats().entries_ == 2000);
+        assert(packed.stats().valid_ && packed.stats().entries_ == 2000);
+        assert(bpt.find(6000).value() == 0 && bpt.find(11997).value() == 5997);
+        // a later snapshot sees the new pairs
+        snap = bpt.snapshot();
+        seen = 0;
+        bpt.for_each(snap, [&seen](const int& key, const int& val) {
+            assert(key == 6000 + seen * 3 && val == seen * 3);
+            seen++;
+        });
+        bpt.release(snap);
+        assert(seen == 2000);
+    }
+
+    {
+        // compaction drops freed pages and keeps the contents
+        BPlusTree<int, int, 512> bpt("bpt_test_compact.dat");
+        BPlusTree<int, int, 512, true> packed("bpt_test_compact_packed.dat");
+        for (int i = 0; i < 20000; i++) {
+            assert(bpt.insert((i * 7919) % 20000, i));
+            assert(packed.insert((i * 7919) % 20000, i));
+        }
+        for (int i = 0; i < 20000; i++) {
+            if (i % 5 != 0) {
+                bpt.erase((i * 7919) % 20000, i);
+                packed.erase((i * 7919) % 20000, i);
+            }
+        }
+        bpt.flush();
+        auto before = fs::file_size("bpt_test_compact.dat");
+        sjtu::TreeStats st = bpt.stats();
+        assert(st.valid_ && packed.stats().valid_);
+        assert(st.entries_ == 4000 && st.free_pages_ > 0);
+        bpt.compact();
+        packed.compact();
+        bpt.flush();
+        assert(fs::file_size("bpt_test_compact.dat") * 3 < before);
+        assert(!fs::exists("bpt_test_compact.dat.compact.dat"));
+        st = bpt.stats();
+        assert(st.valid_ && st.entries_ == 4000 && st.free_pages_ == 0);
+        assert(st.sequentiality_ == 1.0 && st.min_leaf_fill_ > 0.45 && st.avg_leaf_fill_ > 0.85);
+        assert(st.level_pages_[0] == 1 && st.level_pages_.size() == static_cast<size_t>(st.height_));
+        st = packed.stats();
+        assert(st.valid_ && st.entries_ == 4000 && st.free_pages_ == 0);
+        for (int i = 0; i < 20000; i += 5) {
+            assert(bpt.find((i * 7919) % 20000).value() == i);
+            assert(packed.find((i * 7919) % 20000).value() == i);
+        }
+        assert(!bpt.find(1).has_value());
+        for (int i = 0; i < 1000; i++) {
+            bpt.insert(20000 + i, i);
+            bpt.erase((i * 5 * 7919) % 20000, i * 5);
+        }
+        sjtu::vector<int> vec;
+        bpt.serialize(vec);
+        assert(vec.size() == 4000);
+        packed.serialize(vec);
+        assert(vec.size() == 4000);
+        assert(bpt.stats().valid_);
+    }
+
+    {
+        BPlusTree<int, int, 512> bpt("bpt_test_compact.dat");
+        sjtu::vector<int> vec;
+        bpt.serialize(vec);
+        assert(vec.size() == 4000 && vec[3999] == 999);
+        BPlusTree<int, int> empty("bpt_test_compact_empty.dat");
+        empty.compact();
+        assert(empty.empty());
+        assert(empty.insert(1, 1) && empty.find(1).value() == 1);
+    }
+
+    {
+        // a compaction cut off after switching the internal file is finished when the tree is opened
+        fs::copy_file("bpt_test_compact.dat", "bpt_test_compact.dat.old");
+        {
+            BPlusTree<int, int, 512> bpt("bpt_test_compact.dat");
+            assert(bpt.compact());
+        }
+        fs::rename("bpt_test_compact.dat", "bpt_test_compact.dat.compact.dat");
+        fs::rename("bpt_test_compact.dat.old", "bpt_test_compact.dat");
+        std::ofstream("bpt_test_compact.dat.compact.dat.internal.dat") << "left over";
+        BPlusTree<int, int, 512> bpt("bpt_test_compact.dat");
+        assert(!fs::exists("bpt_test_compact.dat.compact.dat"));
+        assert(!fs::exists("bpt_test_compact.dat.compact.dat.internal.dat"));
+        assert(bpt.stats().valid_);
+        sjtu::vector<int> vec;
+        bpt.serialize(vec);
+        assert(vec.size() == 4000 && vec[3999] == 999);
+    }
+
+    {
+        // erasing and inserting the same keys again leaves the lazy tree's pages alone
+        BPlusTree<int, int, 512> eager("bpt_test_eager.dat");
+        BPlusTree<int, int, 512> lazy("bpt_test_lazy.dat");
+        eager.set_merge_fill(0.5);
+        for (int i = 0; i < 10000; i++) {
+            assert(eager.insert((i * 7919) % 10000, i));
+            assert(lazy.insert((i * 7919) % 10000, i));
+        }
+        eager.flush();
+        lazy.flush();
+        auto eager_size = fs::file_size("bpt_test_eager.dat");
+        auto lazy_size = fs::file_size("bpt_test_lazy.dat");
+        for (int round = 0; round < 5; round++) {
+            for (int i = 0; i < 10000; i += 3) {
+                eager.erase((i * 7919) % 10000, i);
+                lazy.erase((i * 7919) % 10000, i);
+            }
+            for (int i = 0; i < 10000; i += 3) {
+                assert(eager.insert((i * 7919) % 10000, i));
+                assert(lazy.insert((i * 7919) % 10000, i));
+            }
+        }
+        eager.flush();
+        lazy.flush();
+        assert(fs::file_size("bpt_test_eager.dat") > eager_size);
+        assert(fs::file_size("bpt_test_lazy.dat") == lazy_size);
+        for (int i = 0; i < 9990; i++) {
+            lazy.erase((i * 7919) % 10000, i);
+        }
+        sjtu::TreeStats st = lazy.stats();
+        assert(st.valid_ && st.entries_ == 10);
+        lazy.flush();
+        st = lazy.stats();
+        assert(st.valid_ && st.height_ == 1 && lazy.find((9995 * 7919) % 10000).value() == 9995);
+    }
+
+    {
+        // emptied compressed leaves next to byte-full ones are merged away
+        BPlusTree<int, int, 512, true> packed("bpt_test_packed_empty.dat");
+        unsigned seed = 12345;
+        sjtu::vector<int> vals;
+        for (int i = 0; i < 8000; i++) {
+            seed = seed * 1103515245 + 12345;
+            // small values pack densely, large ones fill a page in a few entries
+            vals.push_back(i % 400 < 200 ? i : static_cast<int>(seed >> 1));
+            assert(packed.insert(i, vals[i]));
+        }
+        for (int i = 0; i < 8000; i++) {
+            if (i % 400 >= 150 && i % 400 < 250) {
+                packed.erase(i, vals[i]);
+            }
+        }
+        sjtu::TreeStats st = packed.stats();
+        assert(st.valid_ && st.entries_ == 6000);
+        for (int i = 0; i < 8000; i += 7) {
+            assert(packed.find(i).has_value() == (i % 400 < 150 || i % 400 >= 250));
+        }
+    }
+
+    {
+        // the filter never turns away an added key and rarely lets a missing one through
+        sjtu::BloomFilter<FixedString<20>> bloom;
+        assert(!bloom.open("bpt_test_bloom.dat"));
+        bloom.reset(10000);
+        for (int i = 0; i < 10000; i++) {
+            bloom.add(FixedString<20>("train" + std::to_string(i)));
+        }
+        assert(!bloom.full());
+        int false_positives = 0;
+        for (int i = 0; i < 10000; i++) {
+            assert(bloom.may_contain(FixedString<20>("train" + std::to_string(i))));
+            false_positives += bloom.may_contain(FixedString<20>("plane" + std::to_string(i)));
+        }
+        assert(false_positives < 300);
+        bloom.flush();
+        sjtu::BloomFilter<FixedString<20>> reopened;
+        assert(reopened.open("bpt_test_bloom.dat"));
+        assert(reopened.may_contain(FixedString<20>("train42")));
+    }
+
+    {
+        BPlusTree<FixedString<20>, int> bpt("bpt_test_filtered.dat", true);
+        for (int i = 0; i < 30000; i++) {
+            assert(bpt.insert(FixedString<20>("user" + std::to_string(i)), i));
+        }
+        bpt.erase(FixedString<20>("user7"), 7);
+        assert(!bpt.find(FixedString<20>("user7")).has_value());
+    }
+
+    {
+        // the saved filter is loaded on open, and rebuilt if it was left dirty
+        for (int round = 0; round < 2; round++) {
+            BPlusTree<FixedString<20>, int> bpt("bpt_test_filtered.dat", true);
+            for (int i = 0; i < 30000; i += 7) {
+                assert(bpt.find(FixedString<20>("user" + std::to_string(i))).value_or(7) == i);
+                assert(!bpt.find(FixedString<20>("guest" + std::to_string(i))).has_value());
+            }
+            sjtu::vector<int> vec;
+            bpt.find_all(FixedString<20>("user29999"), vec);
+            assert(vec.size() == 1 && vec[0] == 29999);
+            assert(bpt.insert(FixedString<20>("visitor" + std::to_string(round)), round));
+            bpt.flush();
+            assert(bpt.find(FixedString<20>("visitor0")).value() == 0);
+            std::fstream file("bpt_test_filtered.dat.bloom.dat", std::ios::in | std::ios::out | std::ios::binary);
+            uint64_t dirty = 0;
+            file.write(reinterpret_cast<char *>(&dirty), sizeof(dirty));
+        }
+        BPlusTree<FixedString<20>, int> bpt("bpt_test_filtered.dat", true);
+        assert(bpt.find(FixedString<20>("visitor1")).value() == 1);
+        bpt.compact();
+        assert(bpt.find(FixedString<20>("user123")).value() == 123);
+        bpt.clear();
+        assert(!bpt.find(FixedString<20>("user123")).has_value());
+        assert(bpt.insert(FixedString<20>("user123"), 1) && bpt.find(FixedString<20>("user123")).value() == 1);
+    }
+
+    {
+        // range erase drops whole leaves and trims the two at its ends
+        BPlusTree<int, int, 512> bpt("bpt_test_range.dat");
+        BPlusTree<int, int, 512, true> packed("bpt_test_range_packed.dat");
+        for (int i = 0; i < 20000; i++) {
+            assert(bpt.insert(i / 2, i));
+            assert(packed.insert(i / 2, i));
+        }
+        assert(bpt.erase_range(1000, 7999) == 14000);
+        assert(packed.erase_range(1000, 7999) == 14000);
+        assert(bpt.erase_range(1000, 7999) == 0);
+        assert(bpt.erase_range(0, 0) == 2 && packed.erase_range(0, 0) == 2);
+        assert(bpt.erase_range(9990, 20000) == 20);
+        assert(packed.erase_range(9990, 20000) == 20);
+        assert(bpt.stats().valid_ && packed.stats().valid_);
+        // the trimmed ends are rebalanced like the leaves of erase
+        bpt.rebalance();
+        packed.rebalance();
+        sjtu::TreeStats st = bpt.stats();
+        assert(st.valid_ && st.min_leaf_fill_ >= sjtu::MERGE_FILL);
+        st = packed.stats();
+        assert(st.valid_ && st.min_leaf_fill_ >= sjtu::MERGE_FILL);
+        sjtu::vector<int> vec;
+        bpt.serialize(vec);
+        assert(vec.size() == 5978 && vec[0] == 2 && vec[1997] == 1999 && vec[1998] == 16000);
+        packed.serialize(vec);
+        assert(vec.size() == 5978 && vec[5977] == 19979);
+        assert(bpt.find(999).value() == 1998 && !bpt.find(1000).has_value());
+        assert(packed.find(8000).value() == 16000 && !packed.find(7999).has_value());
+        assert(bpt.insert(5000, 1) && bpt.find(5000).value() == 1);
+        assert(bpt.erase_range(0, 20000) == 5979 && bpt.empty());
+        assert(packed.erase_range(0, 20000) == 5978 && packed.empty());
+        assert(bpt.insert(3, 3) && bpt.find(3).value() == 3);
+    }
+
+    {
+        SeparatedBPlusTree<FixedString<20>, Record, int, RecordIndexer> bpt("bpt_test_separated.dat");
+        for (int i = 0; i < 2000; i++) {
+            Record r{i, {}};
+            r.payload_[63] = i * 3;
+            assert(bpt.insert(FixedString<20>("user" + std::to_string(i % 100)), r));
+        }
+        Record dup{42, {}};
+        assert(!bpt.insert(FixedString<20>("user42"), dup));
+        sjtu::vector<Record> vec;
+        bpt.find_all(FixedString<20>("user42"), vec);
+        assert(vec.size() == 20);
+        for (int i = 0; i < 20; i++) {
+            assert(vec[i].id_ == 42 + i * 100);
+            assert(vec[i].payload_[63] == vec[i].id_ * 3);
+        }
+        for (int i = 0; i < 2000; i += 3) {
+            Record r{i, {}};
+            bpt.erase(FixedString<20>("user" + std::to_string(i % 100)), r);
+        }
+    }
+
+    {
+        SeparatedBPlusTree<FixedString<20>, Record, int, RecordIndexer> bpt("bpt_test_separated.dat");
+        sjtu::vector<Record> vec;
+        bpt.find_all(FixedString<20>("user1"), vec);
+        for (size_t i = 0; i < vec.size(); i++) {
+            assert(vec[i].id_ % 3 != 0);
+            assert(vec[i].payload_[63] == vec[i].id_ * 3);
+        }
+        bpt.serialize(vec);
+        assert(vec.size() == 2000 - 667);
+        Record r{1, {}};
+        assert(bpt.update(FixedString<20>("user1"), r, [](Record& stored) { stored.payload_[0] = 9; }));
+        assert(bpt.update(FixedString<20>("user1"), r, [](Record& stored) { stored.id_ = 3001; }));
+        assert(!bpt.update(FixedString<20>("user1"), r, [](Record& stored) { stored.id_ = 5; }));
+        bpt.find_all(FixedString<20>("user1"), vec);
+        assert(vec[vec.size() - 1].id_ == 3001 && vec[vec.size() - 1].payload_[0] == 9);
+        r.id_ = 3001;
+        r.payload_[63] = 3;
+        assert(!bpt.upsert(FixedString<20>("user1"), r));
+        bpt.find_all(FixedString<20>("user1"), vec);
+        assert(vec[vec.size() - 1].id_ == 3001 && vec[vec.size() - 1].payload_[63] == 3);
+        // freed records are handed out again before the heap grows
+        auto heap_size = fs::file_size("bpt_test_separated.dat.heap.dat");
+        for (int i = 0; i < 2000; i += 3) {
+            Record r{i, {}};
+            bpt.insert(FixedString<20>("user" + std::to_string(i % 100)), r);
+        }
+        bpt.flush();
+        assert(fs::file_size("bpt_test_separated.dat.heap.dat") == heap_size);
+        bpt.clear();
+        assert(bpt.empty());
+        assert(!bpt.find(FixedString<20>("user1")).has_value());
+    }
+
+    {
+        // leaves and internal pages live in separate files, so a leaf may share the root's position
+        BPlusTree<int, int, 512> bpt("bpt_test_drain.dat");
+        BPlusTree<int, int, 512, true> packed("bpt_test_drain_packed.dat");
+        for (int i = 0; i < 20000; i++) {
+            assert(bpt.insert(i, i) && packed.insert(i, i));
+        }
+        for (int i = 0; i + 1 < 20000; i++) {
+            bpt.erase(i, i);
+            packed.erase(i, i);
+            assert(bpt.find(i + 1).has_value() && packed.find(i + 1).has_value());
+        }
+        assert(bpt.stats().entries_ == 1 && packed.stats().entries_ == 1);
+    }
+
+    {
+        // separators of a unique tree hold keys alone, so large values do not make it taller
+        BPlusTree<int, Record, 4096> plain("bpt_test_plain_keys.dat");
+        BPlusTree<int, Record, 4096, false, true> bpt("bpt_test_unique_keys.dat");
+        for (int i = 0; i < 6000; i++) {
+            Record r{i, {}};
+            r.payload_[0] = i * 2;
+            assert(plain.insert(i, r) && bpt.insert(i, r));
+        }
+        assert(bpt.stats().valid_ && bpt.stats().height_ < plain.stats().height_);
+        // a key is stored once, whatever the value
+        Record r{7, {}};
+        assert(!bpt.insert(7, r) && !bpt.insert(6000 - 1, r));
+        assert(bpt.find(7).value().payload_[0] == 14);
+        r.payload_[0] = 1;
+        assert(!bpt.upsert(7, r) && bpt.find(7).value().payload_[0] == 1);
+        assert(bpt.upsert(6000, r) && bpt.find(6000).has_value());
+        for (int i = 0; i < 6000; i += 2) {
+            bpt.erase(i, bpt.find(i).value());
+        }
+        bpt.rebalance();
+        assert(bpt.stats().valid_ && bpt.stats().entries_ == 3001);
+        bpt.compact();
+        assert(bpt.stats().valid_ && bpt.find(5999).value().payload_[0] == 11998 && !bpt.find(5998).has_value());
+    }
+
+    {
+        // a file without the format tag, like the shorter header older builds wrote, is refused
+        std::ofstream old_file("bpt_test_legacy.dat", std::ios::binary);
+        old_file << std::string(48, '\0') << std::string(200, 'x');
+        old_file.close();
+        bool refused = false;
+        try {
+            BPlusTree<int, int> bpt("bpt_test_legacy.dat");
+        }
+        catch (const std::runtime_error&) {
+            refused = true;
+        }
+        assert(refused);
+    }
+
+    remove_test_files();
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+
+#include "../include/storage/dynamic_river.hpp"
+
+namespace fs = std::filesystem;
+
+// n bytes of one character, stored as [n] [bytes]
+struct Blob {
+    int n_;
+    char fill_;
+};
+
+struct BlobStringifier {
+    char *operator()(Blob& b, int& len) const {
+        len = 4 + b.n_;
+        char *data = new char[len];
+        memcpy(data, &b.n_, 4);
+        memset(data + 4, b.fill_, b.n_);
+        return data;
+    }
+};
+
+struct BlobAntiStringifier {
+    Blob operator()(const char *data) const {
+        Blob b;
+        memcpy(&b.n_, data, 4);
+        b.fill_ = b.n_ ? data[4] : 0;
+        for (int i = 0; i < b.n_; i++) {
+            assert(data[4 + i] == b.fill_);
+        }
+        return b;
+    }
+};
+
+struct BlobSizeCalculator {
+    int operator()(int size) const {
+        return 4 + size;
+    }
+};
+
+typedef sjtu::DynamicRiver<Blob, BlobStringifier, BlobAntiStringifier, BlobSizeCalculator> River;
+
+static const std::string file_name = "dynamic_river_test.dat";
+
+static void remove_test_files() {
+    fs::remove(file_name);
+    fs::remove(file_name + ".free.dat");
+}
+
+static void check(River& river, const std::map<sjtu::diskpos_t, Blob>& live) {
+    for (const auto& [pos, expected] : live) {
+        Blob b;
+        river.read(b, pos);
+        assert(b.n_ == expected.n_);
+        assert(b.n_ == 0 || b.fill_ == expected.fill_);
+    }
+}
+
+int main() {
+    remove_test_files();
+
+    {
+        // erased slots are reused by records of the same size class
+        River river(file_name);
+        Blob a{100, 'a'}, b{40, 'b'}, c{100, 'c'};
+        sjtu::diskpos_t pa = river.write(a);
+        sjtu::diskpos_t pb = river.write(b);
+        river.erase(pa);
+        sjtu::diskpos_t pc = river.write(c);
+        assert(pc == pa);
+        Blob d{300, 'd'};
+        assert(river.write(d) > pb);
+
+        // growing out of its class moves a record, staying in it does not
+        Blob grown{200, 'e'};
+        sjtu::diskpos_t pe = river.update(grown, pb);
+        assert(pe != pb);
+        Blob same{95, 'f'};
+        assert(river.update(same, pc) == pc);
+        Blob r;
+        river.read(r, pe);
+        assert(r.n_ == 200 && r.fill_ == 'e');
+        river.read(r, pc);
+        assert(r.n_ == 95 && r.fill_ == 'f');
+    }
+    remove_test_files();
+
+    {
+        // churn keeps the file bounded, and the free lists survive reopening
+        std::mt19937 rng(42);
+        std::map<sjtu::diskpos_t, Blob> live;
+        uintmax_t peak = 0;
+        for (int round = 0; round < 6; round++) {
+            River river(file_name);
+            check(river, live);
+            for (int op = 0; op < 3000; op++) {
+                // about 100 records stay live
+                int kind = live.size() < 100 ? 0 : 1 + rng() % 2;
+                if (kind == 0) {
+                    Blob b{static_cast<int>(rng() % 400), static_cast<char>('a' + rng() % 26)};
+                    sjtu::diskpos_t pos = river.write(b);
+                    assert(live.find(pos) == live.end());
+                    live[pos] = b;
+                }
+                else {
+                    auto it = live.begin();
+                    std::advance(it, rng() % live.size());
+                    if (kind == 1) {
+                        river.erase(it->first);
+                        live.erase(it);
+                    }
+                    else {
+                        Blob b{static_cast<int>(rng() % 400), static_cast<char>('a' + rng() % 26)};
+                        sjtu::diskpos_t pos = river.update(b, it->first);
+                        live.erase(it);
+                        assert(live.find(pos) == live.end());
+                        live[pos] = b;
+                    }
+                }
+            }
+            check(river, live);
+            river.flush();
+            if (round == 1) {
+                peak = fs::file_size(file_name);
+            }
+        }
+        // the file stops growing once the free lists fill
+        assert(fs::file_size(file_name) < peak * 3 / 2);
+    }
+    remove_test_files();
+
+    {
+        // records written before slots were padded fill exactly their own length
+        std::ofstream legacy(file_name, std::ios::binary);
+        BlobStringifier str;
+        sjtu::diskpos_t pos[3];
+        sjtu::diskpos_t end = 0;
+        for (int i = 0; i < 3; i++) {
+            Blob b{70, static_cast<char>('x' + i)};
+            int len = 0;
+            char *data = str(b, len);
+            legacy.write(data, len);
+            delete []data;
+            pos[i] = end;
+            end += len;
+        }
+        legacy.close();
+
+        River river(file_name);
+        river.erase(pos[0]);
+        // 74 bytes only fit records of two granules, never the 74-byte ones that need three
+        Blob big{70, 'q'};
+        assert(river.write(big) >= end);
+        Blob small{50, 's'};
+        assert(river.write(small) == pos[0]);
+        Blob r;
+        river.read(r, pos[1]);
+        assert(r.n_ == 70 && r.fill_ == 'y');
+        river.read(r, pos[0]);
+        assert(r.n_ == 50 && r.fill_ == 's');
+    }
+    remove_test_files();
+
+    return 0;
+}
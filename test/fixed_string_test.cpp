@@ -83,5 +83,20 @@ int main() {
         assert(os.str() == "hello");
     }
 
+    {
+        FixedString<20> a("user10");
+        FixedString<20> b("user2");
+        FixedString<20> c("user10abc");
+        FixedString<20> d("user10abd");
+        FixedString<3> e("ab");
+        assert(a.prefix() < b.prefix());
+        assert(a.prefix() < c.prefix());
+        assert(c.prefix() == d.prefix());
+        assert(FixedString<20>().prefix() == 0);
+        assert(e.prefix() == (uint64_t('a') << 56 | uint64_t('b') << 48));
+        FixedString<20> high("\xff");
+        assert(a.prefix() < high.prefix());
+    }
+
     return 0;
 }
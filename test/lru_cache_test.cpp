@@ -0,0 +1,74 @@
+#include <cassert>
+
+#include "../include/stl/lru_cache.hpp"
+
+using sjtu::lru_cache;
+
+int main() {
+    {
+        lru_cache<int, int> cache(2);
+        assert(cache.get(1) == nullptr);
+        cache.put(1, 10);
+        cache.put(2, 20);
+        assert(cache.size() == 2);
+        assert(*cache.get(1) == 10);
+        // 2 is now the least recently used
+        cache.put(3, 30);
+        assert(cache.size() == 2);
+        assert(cache.get(2) == nullptr);
+        assert(*cache.get(1) == 10);
+        assert(*cache.get(3) == 30);
+    }
+
+    {
+        lru_cache<int, int> cache(2);
+        cache.put(1, 10);
+        cache.put(2, 20);
+        cache.put(1, 11);
+        assert(cache.size() == 2);
+        cache.put(3, 30);
+        assert(cache.get(2) == nullptr);
+        assert(*cache.get(1) == 11);
+        *cache.get(3) = 31;
+        assert(*cache.get(3) == 31);
+    }
+
+    {
+        lru_cache<int, int> cache(3);
+        for (int i = 0; i < 3; i++) {
+            cache.put(i, i);
+        }
+        cache.erase(1);
+        cache.erase(7);
+        assert(cache.size() == 2);
+        assert(cache.get(1) == nullptr);
+        cache.put(3, 3);
+        cache.put(4, 4);
+        assert(cache.get(0) == nullptr);
+        assert(cache.get(2) && cache.get(3) && cache.get(4));
+        cache.clear();
+        assert(cache.size() == 0);
+        assert(cache.get(2) == nullptr);
+        cache.put(5, 5);
+        assert(*cache.get(5) == 5);
+    }
+
+    {
+        lru_cache<int, int> cache(0);
+        cache.put(1, 1);
+        assert(cache.size() == 0);
+        assert(cache.get(1) == nullptr);
+    }
+
+    {
+        lru_cache<int, int> cache(64);
+        for (int i = 0; i < 10000; i++) {
+            cache.put(i % 100, i);
+            assert(cache.size() <= 64);
+        }
+        assert(*cache.get(99) == 9999);
+        assert(cache.get(0) == nullptr);
+    }
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <cassert>
+#include <cstdlib>
+
+#include "../include/utils/seat_kernel.hpp"
+
+using sjtu::SeatKernelLevel;
+
+namespace {
+
+const int row_len = 100;
+
+void fill(int* row, unsigned seed) {
+    srand(seed);
+    for (int i = 0; i < row_len; i++) {
+        row[i] = rand() % 200000 - 1000;
+    }
+}
+
+template<typename Min, typename Add>
+void check(Min seat_min, Add seat_add) {
+    int row[row_len], expect[row_len];
+    for (unsigned seed = 0; seed < 20; seed++) {
+        fill(row, seed);
+        for (int from = 0; from <= row_len; from++) {
+            for (int to = from; to <= row_len; to++) {
+                assert(seat_min(row, from, to, 100000) == sjtu::seat_min_scalar(row, from, to, 100000));
+            }
+        }
+        // empty range keeps the bound
+        assert(seat_min(row, 7, 7, 42) == 42);
+        for (int k = 0; k < 50; k++) {
+            int from = rand() % (row_len + 1), to = rand() % (row_len + 1), val = rand() % 11 - 5;
+            if (from > to) {
+                int tmp = from;
+                from = to;
+                to = tmp;
+            }
+            for (int i = 0; i < row_len; i++) {
+                expect[i] = row[i];
+            }
+            sjtu::seat_add_scalar(expect, from, to, val);
+            seat_add(row, from, to, val);
+            for (int i = 0; i < row_len; i++) {
+                assert(row[i] == expect[i]);
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    {
+        int row[5] = {5, 3, 8, 1, 9};
+        assert(sjtu::seat_min_scalar(row, 0, 3, 10) == 3);
+        assert(sjtu::seat_min_scalar(row, 0, 5, 0) == 0);
+        sjtu::seat_add_scalar(row, 1, 4, -1);
+        assert(row[0] == 5 && row[1] == 2 && row[2] == 7 && row[3] == 0 && row[4] == 9);
+    }
+
+    check(sjtu::seat_min, sjtu::seat_add);
+
+#ifdef SEAT_KERNEL_X86
+    if (sjtu::seat_kernel_level() >= SeatKernelLevel::SSE41) {
+        check(sjtu::seat_min_sse41, sjtu::seat_add_sse41);
+    }
+    if (sjtu::seat_kernel_level() >= SeatKernelLevel::AVX2) {
+        check(sjtu::seat_min_avx2, sjtu::seat_add_avx2);
+    }
+#endif
+
+    return 0;
+}
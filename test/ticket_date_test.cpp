@@ -0,0 +1,100 @@
+#include <cassert>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../include/system/ticket.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// runs the commands on a fresh system in its own directory and returns what it prints
+std::string run(const std::string& commands) {
+    fs::path dir = fs::temp_directory_path() / "ticket_date_test";
+    fs::path cwd = fs::current_path();
+    fs::remove_all(dir);
+    fs::create_directory(dir);
+    fs::current_path(dir);
+    std::istringstream in(commands);
+    std::ostringstream out;
+    std::streambuf *cin_buf = std::cin.rdbuf(in.rdbuf());
+    std::streambuf *cout_buf = std::cout.rdbuf(out.rdbuf());
+    {
+        sjtu::TicketSystem sys;
+        sys.run();
+    }
+    std::cin.rdbuf(cin_buf);
+    std::cout.rdbuf(cout_buf);
+    std::cin.clear();
+    fs::current_path(cwd);
+    fs::remove_all(dir);
+    return out.str();
+}
+
+// A leaves 甲 on 12-30 and 12-31 and reaches 乙 and 丙 the next day; B and E continue to 丁
+const std::string setup =
+    "[1] add_user -c cur -u root -p pw -n 管理员 -m a@b.c -g 10\n"
+    "[2] login -u root -p pw\n"
+    "[3] add_train -i A -n 3 -m 100 -s 甲|乙|丙 -p 10|20 -x 23:00 -t 120|600 -o 10 -d 12-30|12-31 -y G\n"
+    "[4] add_train -i B -n 2 -m 50 -s 丙|丁 -p 5 -x 12:00 -t 60 -o _ -d 01-01|01-10 -y G\n"
+    "[5] add_train -i D -n 2 -m 80 -s 甲|丙 -p 40 -x 20:00 -t 30 -o _ -d 12-31|12-31 -y G\n"
+    "[6] add_train -i E -n 2 -m 80 -s 丙|丁 -p 40 -x 21:00 -t 30 -o _ -d 12-31|12-31 -y G\n"
+    "[7] release_train -i A\n"
+    "[8] release_train -i B\n"
+    "[9] release_train -i D\n"
+    "[10] release_train -i E\n";
+
+const std::string setup_output =
+    "[1] 0\n[2] 0\n[3] 0\n[4] 0\n[5] 0\n[6] 0\n[7] 0\n[8] 0\n[9] 0\n[10] 0\n";
+
+} // namespace
+
+int main() {
+    // a train that left in December is found, sold and refunded at a station it reaches in January
+    std::string out = run(setup +
+        "[11] query_ticket -s 乙 -t 丙 -d 01-01\n"
+        "[12] buy_ticket -u root -i A -d 01-01 -f 乙 -t 丙 -n 3\n"
+        "[13] query_ticket -s 甲 -t 丙 -d 12-31\n"
+        "[14] refund_ticket -u root -n 1\n"
+        "[15] query_ticket -s 乙 -t 丙 -d 01-01\n"
+        "[16] query_ticket -s 乙 -t 丙 -d 12-31\n");
+    assert(out == setup_output +
+        "[11] 1\nA 乙 01-01 01:10 -> 丙 01-01 11:10 20 100\n"
+        "[12] 60\n"
+        "[13] 2\nD 甲 12-31 20:00 -> 丙 12-31 20:30 40 80\nA 甲 12-31 23:00 -> 丙 01-01 11:10 30 97\n"
+        "[14] 0\n"
+        "[15] 1\nA 乙 01-01 01:10 -> 丙 01-01 11:10 20 100\n"
+        "[16] 1\nA 乙 12-31 01:10 -> 丙 12-31 11:10 20 100\n");
+
+    // transfers start from a January station, and one crossing new year is not counted as negative time
+    out = run(setup +
+        "[11] query_transfer -s 乙 -t 丁 -d 01-01\n"
+        "[12] query_transfer -s 甲 -t 丁 -d 12-31 -p time\n"
+        "[13] query_transfer -s 甲 -t 丁 -d 12-31 -p cost\n");
+    assert(out == setup_output +
+        "[11] A 乙 01-01 01:10 -> 丙 01-01 11:10 20 100\nB 丙 01-01 12:00 -> 丁 01-01 13:00 5 50\n"
+        "[12] D 甲 12-31 20:00 -> 丙 12-31 20:30 40 80\nE 丙 12-31 21:00 -> 丁 12-31 21:30 40 80\n"
+        "[13] A 甲 12-31 23:00 -> 丙 01-01 11:10 30 100\nB 丙 01-01 12:00 -> 丁 01-01 13:00 5 50\n");
+
+    // a waitlisted January departure of a December train is not expired on 12-31, only once it has left
+    out = run(setup +
+        "[11] buy_ticket -u root -i A -d 12-30 -f 甲 -t 丙 -n 100\n"
+        "[12] buy_ticket -u root -i A -d 12-30 -f 甲 -t 乙 -n 1 -q true\n"
+        "[13] buy_ticket -u root -i A -d 01-01 -f 乙 -t 丙 -n 100\n"
+        "[14] buy_ticket -u root -i A -d 01-01 -f 乙 -t 丙 -n 2 -q true\n"
+        "[15] expire -d 12-31\n"
+        "[16] expire -d 12-31\n"
+        "[17] expire -d 01-02\n"
+        "[18] query_order -u root\n");
+    assert(out == setup_output +
+        "[11] 3000\n[12] queue\n[13] 2000\n[14] queue\n"
+        "[15] 1\n[16] 0\n[17] 1\n"
+        "[18] 4\n"
+        "[expired] A 乙 01-01 01:10 -> 丙 01-01 11:10 20 2\n"
+        "[success] A 乙 01-01 01:10 -> 丙 01-01 11:10 20 100\n"
+        "[expired] A 甲 12-30 23:00 -> 乙 12-31 01:00 10 1\n"
+        "[success] A 甲 12-30 23:00 -> 丙 12-31 11:10 30 100\n");
+    return 0;
+}
@@ -0,0 +1,174 @@
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include "../include/system/train.hpp"
+
+using sjtu::Train;
+using sjtu::TrainAntiStringifier;
+using sjtu::TrainFixedExpander;
+using sjtu::TrainFixedStringifier;
+using sjtu::TrainSizeCalculator;
+using sjtu::TrainStringifier;
+using sjtu::TrainView;
+
+namespace fs = std::filesystem;
+
+namespace {
+
+Train make_train(int n, int scale) {
+    Train t{};
+    t.stationNum_ = n;
+    t.trainID_ = sjtu::FixedString<20>(n == 20 ? "ABCDEFGHIJKLMNOPQRST" : "G1234");
+    t.seatNum_ = 100000;
+    t.startTime_ = 23 * 60 + 59;
+    t.startSaleDate_ = sjtu::date(6, 1);
+    t.endSaleDate_ = sjtu::date(8, 31);
+    t.type_ = 'G';
+    t.released_ = false;
+    t.seat_base_ = 123456789;
+    for (int i = 0; i < n; i++) {
+        t.stations_[i] = i * scale * 37;
+        if (i + 1 < n) {
+            t.prices_[i] = 100000 - i * scale;
+            t.travelTimes_[i] = 10000 - i * scale;
+        }
+        if (i > 0 && i + 1 < n) {
+            t.stopoverTimes_[i] = 10000 - i;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        t.priceSums_[i] = i ? t.priceSums_[i - 1] + t.prices_[i - 1] : 0;
+        t.arrivalMinutes_[i] = i ? t.leavingMinutes_[i - 1] + t.travelTimes_[i - 1] : t.startTime_;
+        t.leavingMinutes_[i] = t.arrivalMinutes_[i] + t.stopoverTimes_[i];
+    }
+    return t;
+}
+
+void check_same(const Train& a, const Train& b) {
+    assert(a.stationNum_ == b.stationNum_);
+    assert(a.trainID_ == b.trainID_);
+    assert(a.seatNum_ == b.seatNum_);
+    assert(a.startTime_ == b.startTime_);
+    assert(int(a.startSaleDate_) == int(b.startSaleDate_));
+    assert(int(a.endSaleDate_) == int(b.endSaleDate_));
+    assert(a.type_ == b.type_);
+    assert(a.released_ == b.released_);
+    assert(a.seat_base_ == b.seat_base_);
+    for (int i = 0; i < a.stationNum_; i++) {
+        assert(a.stations_[i] == b.stations_[i]);
+        assert(a.stopoverTimes_[i] == b.stopoverTimes_[i]);
+        assert(a.priceSums_[i] == b.priceSums_[i]);
+        assert(a.arrivalMinutes_[i] == b.arrivalMinutes_[i]);
+        assert(a.leavingMinutes_[i] == b.leavingMinutes_[i]);
+        if (i + 1 < a.stationNum_) {
+            assert(a.prices_[i] == b.prices_[i]);
+            assert(a.travelTimes_[i] == b.travelTimes_[i]);
+        }
+    }
+}
+
+int header(const char *data) {
+    int siz;
+    memcpy(&siz, data, 4);
+    return siz;
+}
+
+} // namespace
+
+int main() {
+    for (int n : {2, 3, 20, 100}) {
+        for (int scale : {0, 1, 97}) {
+            Train t = make_train(n, scale);
+
+            // compact round trip, with the length in the header
+            int len = 0;
+            std::unique_ptr<char[]> compact(TrainStringifier()(t, len));
+            assert(TrainSizeCalculator()(header(compact.get())) == len);
+            check_same(TrainAntiStringifier()(compact.get()), t);
+
+            // records in the fixed layout are still read, and never smaller than compact ones
+            int fixed_len = 0;
+            std::unique_ptr<char[]> fixed(TrainFixedStringifier()(t, fixed_len));
+            assert(fixed_len == 56 + 28 * n);
+            assert(TrainSizeCalculator()(header(fixed.get())) == fixed_len);
+            assert(len <= fixed_len);
+            // expanding the compact record gives the same fixed layout
+            int expanded_len = 0;
+            std::unique_ptr<char[]> expanded(TrainFixedExpander()(compact.get(), expanded_len));
+            assert(expanded_len == fixed_len && memcmp(expanded.get(), fixed.get(), fixed_len) == 0);
+            Train migrated = TrainAntiStringifier()(fixed.get());
+            check_same(migrated, t);
+            int again_len = 0;
+            std::unique_ptr<char[]> again(TrainStringifier()(migrated, again_len));
+            assert(again_len == len && memcmp(again.get(), compact.get(), len) == 0);
+
+            // releasing keeps the record length, so it is rewritten in place
+            t.released_ = true;
+            int released_len = 0;
+            std::unique_ptr<char[]> released(TrainStringifier()(t, released_len));
+            assert(released_len == len);
+            assert(TrainAntiStringifier()(released.get()).released_);
+
+            TrainView view(std::shared_ptr<const char[]>(fixed.release()));
+            assert(view.station_num() == n);
+            assert(view.train_id() == t.trainID_);
+            assert(view.seat_base() == t.seat_base_);
+            for (int i = 0; i < n; i++) {
+                assert(view.station(i) == t.stations_[i]);
+                assert(view.price_sum(i) == t.priceSums_[i]);
+                assert(view.leaving_minutes(i) == t.leavingMinutes_[i]);
+            }
+        }
+    }
+    {
+        // a train file from before the compact format is refused on open, whichever old layout it holds
+        const std::string name = "train_codec_test";
+        auto remove_files = [&name]() {
+            for (const auto& entry : fs::directory_iterator(".")) {
+                if (entry.path().filename().string().rfind(name + "_", 0) == 0) {
+                    fs::remove(entry.path());
+                }
+            }
+        };
+        for (int layout = 0; layout < 2; layout++) {
+            remove_files();
+            std::ofstream legacy(name + "_trains.dat", std::ios::binary);
+            Train t = make_train(11, 1);
+            int len = 0;
+            std::unique_ptr<char[]> data(TrainFixedStringifier()(t, len));
+            if (layout == 1) {
+                // the original layout also starts with the station count, but is 60 + 396n bytes long
+                len = 60 + 396 * t.stationNum_;
+                data.reset(new char[len]());
+                memcpy(data.get(), &t.stationNum_, 4);
+            }
+            legacy.write(data.get(), len);
+            legacy.close();
+            bool refused = false;
+            try {
+                sjtu::TrainSystem trains(name);
+            }
+            catch (const std::runtime_error&) {
+                refused = true;
+            }
+            assert(refused);
+        }
+        // a file of compact records opens again
+        remove_files();
+        {
+            sjtu::TrainSystem trains(name);
+            Train t = make_train(11, 1);
+            assert(trains.add_train(t) >= 0);
+        }
+        {
+            sjtu::TrainSystem trains(name);
+            assert(trains.train_id("G1234") >= 0);
+        }
+        remove_files();
+    }
+    return 0;
+}
@@ -56,6 +56,12 @@ struct Empty {};
 struct NonTrivialDtor {
     ~NonTrivialDtor() {}
 };
+struct WithPrefix {
+    uint64_t prefix() const { return 0; }
+};
+struct WithIntPrefix {
+    int prefix() const { return 0; }
+};
 struct NoCopy {
     NoCopy() = default;
     NoCopy(const NoCopy&) = delete;
@@ -76,6 +82,9 @@ int main() {
     static_assert(has_operator_equal_v<WithEqInt>);
     static_assert(has_operator_equal_v<const WithEq>);
     static_assert(!has_operator_equal_v<const WithEqNonConst>);
+    static_assert(has_key_prefix_v<WithPrefix>);
+    static_assert(!has_key_prefix_v<WithIntPrefix>);
+    static_assert(!has_key_prefix_v<NoOps>);
 
     WithEq a{1}, b{1};
     assert(a == b);